@@ -0,0 +1,145 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include "memory_stats.h"
+#include "numa.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+
+// Arena para construcao de cenas.
+//
+// Primitivas, materiais e texturas criados com make_scene_ptr enquanto uma arena esta
+// ativa na thread (scene_arena::scope) sao alocados em blocos contiguos, junto com o
+// bloco de controle do shared_ptr. Liberar um objeto nao devolve memoria: os blocos sao
+// liberados todos de uma vez quando o ultimo objeto da arena e destruido. Uma arena deve
+// ser preenchida por uma thread de cada vez.
+//
+// Com ou sem arena, cada objeto e seu bloco de controle entram na contabilidade de
+// memoria (memory_stats.h) enquanto o objeto vive. Em maquinas NUMA as paginas dos blocos
+// sao espalhadas pelos nos (numa.h), ja que todas as threads leem a cena.
+
+class scene_arena {
+    public:
+        static constexpr size_t chunk_size = 1 << 16;
+
+        scene_arena() : state(new arena_state) {}
+        ~scene_arena() { release(state); }
+
+        scene_arena(const scene_arena&) = delete;
+        scene_arena& operator=(const scene_arena&) = delete;
+
+        template<class T, class... Args>
+        std::shared_ptr<T> make(Args&&... args) {
+            return std::allocate_shared<T>(allocator<T, T>(state), std::forward<Args>(args)...);
+        }
+
+        size_t bytes_used() const { return state->used; }
+
+        // Makes the arena the target of make_scene_ptr on this thread until destroyed.
+        class scope {
+            public:
+                scope(scene_arena& a) : previous(current()) { current() = &a; }
+                ~scope() { current() = previous; }
+
+                scope(const scope&) = delete;
+                scope& operator=(const scope&) = delete;
+
+            private:
+                scene_arena* previous;
+        };
+
+        static scene_arena*& current() {
+            thread_local scene_arena* active = nullptr;
+            return active;
+        }
+
+    private:
+        struct arena_state {
+            std::atomic<long> refs{1};
+            std::vector<std::unique_ptr<char[]>> chunks;
+            char* cursor = nullptr;
+            char* end = nullptr;
+            size_t used = 0;
+
+            void* allocate(size_t bytes, size_t alignment) {
+                auto p = align_up(cursor, alignment);
+                if (!cursor || p + bytes > end) {
+                    auto size = std::max(chunk_size, bytes + alignment);
+                    chunks.emplace_back(new char[size]);
+                    numa_interleave(chunks.back().get(), size);
+                    cursor = chunks.back().get();
+                    end = cursor + size;
+                    p = align_up(cursor, alignment);
+                }
+                cursor = p + bytes;
+                used += bytes;
+                return p;
+            }
+
+            static char* align_up(char* p, size_t alignment) {
+                auto address = reinterpret_cast<uintptr_t>(p);
+                return reinterpret_cast<char*>((address + alignment - 1) & ~(alignment - 1));
+            }
+        };
+
+        static void release(arena_state* s) {
+            if (s->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete s;
+        }
+
+        // Every object allocated from the arena holds one reference to it, taken when its
+        // block is allocated and dropped when the block is handed back. Object is the
+        // type made, for the memory accounting.
+        template<class T, class Object>
+        struct allocator {
+            using value_type = T;
+
+            arena_state* state;
+
+            allocator(arena_state* s) : state(s) {}
+            template<class U>
+            allocator(const allocator<U, Object>& other) : state(other.state) {}
+
+            T* allocate(size_t n) {
+                auto p = static_cast<T*>(state->allocate(n * sizeof(T), alignof(T)));
+                state->refs.fetch_add(1, std::memory_order_relaxed);
+                tagged_allocator<T, Object>::charge(n, true);
+                return p;
+            }
+
+            void deallocate(T*, size_t n) {
+                tagged_allocator<T, Object>::charge(n, false);
+                release(state);
+            }
+
+            template<class U>
+            struct rebind { using other = allocator<U, Object>; };
+
+            template<class U>
+            bool operator==(const allocator<U, Object>& other) const { return state == other.state; }
+            template<class U>
+            bool operator!=(const allocator<U, Object>& other) const { return state != other.state; }
+        };
+
+    private:
+        arena_state* state;
+};
+
+
+// make_shared that allocates from the thread's active scene arena, if there is one.
+template<class T, class... Args>
+std::shared_ptr<T> make_scene_ptr(Args&&... args) {
+    if (auto arena = scene_arena::current())
+        return arena->make<T>(std::forward<Args>(args)...);
+    return std::allocate_shared<T>(tagged_allocator<T, T>(), std::forward<Args>(args)...);
+}
+
+
+#endif
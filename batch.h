@@ -0,0 +1,200 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "image_stream.h"
+#include "integrator.h"
+#include "material_table.h"
+#include "memory_stats.h"
+#include "qbvh.h"
+#include "thread_pool.h"
+#include "tile_culling.h"
+
+#include <atomic>
+#include <cstdio>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+// Varios quadros da mesma cena.
+//
+// A cena e a qbvh sao montadas uma vez so. Com a cena parada (so a camera muda), os
+// tiles de todos os quadros passam por uma unica fila no pool: enquanto os ultimos tiles
+// de um quadro terminam, as outras threads ja comecam o proximo, e quem termina o quadro
+// grava o arquivo. Com objetos se movendo, antes de cada quadro animate(quadro) muda a
+// cena e a qbvh e reajustada (refit) em vez de reconstruida; a gravacao de um quadro
+// acontece no pool enquanto o proximo e renderizado. Tiles que so veem o fundo
+// (tile_culling.h) sao feitos so com a cor do ambiente.
+
+class batch_renderer {
+    public:
+        batch_renderer(
+            qbvh& b, const light_set& l, const material_table* m,
+            int w, int h, int spp, int depth, int tile = 32
+        ) : bvh(b), lights(l), materials(m), width(w), height(h),
+            samples_per_pixel(spp), max_depth(depth), tile_size(std::max(tile, 1)) {}
+
+        // One frame per camera, written to filename_pattern (printf style, e.g.
+        // "frame_%04d.ppm") as binary PPM.
+        void render_cameras(
+            const std::vector<camera>& cameras, const char* filename_pattern,
+            thread_pool& pool = default_thread_pool());
+
+        // `frames` frames; before each one animate(frame) moves objects of the scene and
+        // the tree is refit, then the frame is rendered from camera_at(frame).
+        void render_animation(
+            int frames, const std::function<camera(int)>& camera_at,
+            const std::function<void(int)>& animate, const char* filename_pattern,
+            thread_pool& pool = default_thread_pool());
+
+    private:
+        int tiles_per_frame() const {
+            return ((width + tile_size - 1) / tile_size) * ((height + tile_size - 1) / tile_size);
+        }
+
+        // Renders one tile of a frame into pixels, stored top row first.
+        void render_tile(
+            const camera& cam, const tile_culler& culler, int tile, std::vector<color>& pixels) const;
+
+        void write_frame(const char* filename_pattern, int frame, const std::vector<color>& pixels) const;
+
+    private:
+        qbvh& bvh;
+        const light_set& lights;
+        const material_table* materials;
+        int width, height;
+        int samples_per_pixel;
+        int max_depth;
+        int tile_size;
+};
+
+
+void batch_renderer::render_tile(
+    const camera& cam, const tile_culler& culler, int tile, std::vector<color>& pixels
+) const {
+    auto across = (width + tile_size - 1) / tile_size;
+    auto x0 = (tile % across) * tile_size, y0 = (tile / across) * tile_size;
+    auto x1 = std::min(x0 + tile_size, width), y1 = std::min(y0 + tile_size, height);
+
+    // Rows are stored top first, so the tile covers image rows [height-y1, height-y0).
+    if (culler.empty(cam, x0, height - y1, x1, height - y0, width, height)) {
+        for (int row = y0; row < y1; row++)
+            for (int i = x0; i < x1; i++)
+                pixels[static_cast<size_t>(row) * width + i] =
+                    samples_per_pixel * background_pixel(cam, lights, i, height - 1 - row, width, height);
+        return;
+    }
+
+    for (int row = y0; row < y1; row++) {
+        auto j = height - 1 - row;
+        for (int i = x0; i < x1; i++) {
+            color pixel_color(0, 0, 0);
+            for (int s = 0; s < samples_per_pixel; ++s) {
+                auto u = (i + random_double()) / (width-1);
+                auto v = (j + random_double()) / (height-1);
+                pixel_color += ray_color(cam.get_ray(u, v), bvh, lights, max_depth, materials);
+            }
+            pixels[static_cast<size_t>(row) * width + i] = pixel_color;
+        }
+    }
+}
+
+
+void batch_renderer::write_frame(
+    const char* filename_pattern, int frame, const std::vector<color>& pixels
+) const {
+    char filename[1024];
+    snprintf(filename, sizeof(filename), filename_pattern, frame);
+    image_stream out(filename, image_format::ppm, width, height, samples_per_pixel);
+    out.write_rows(pixels, height);
+}
+
+
+void batch_renderer::render_cameras(
+    const std::vector<camera>& cameras, const char* filename_pattern, thread_pool& pool
+) {
+    // A frame's buffer is allocated by its first tile and freed once it is written, so
+    // only the few frames in flight hold memory.
+    struct frame_state {
+        std::once_flag allocated;
+        std::vector<color> pixels;
+        std::atomic<int> remaining;
+        memory_charge pixel_bytes{memory_tag::framebuffers};
+    };
+
+    auto tiles = tiles_per_frame();
+    tile_culler culler(bvh);
+    std::vector<std::unique_ptr<frame_state>> frames;
+    for (size_t f = 0; f < cameras.size(); f++) {
+        frames.emplace_back(new frame_state);
+        frames.back()->remaining = tiles;
+    }
+
+    std::atomic<int> written{0};
+    pool.parallel_for(0, cameras.size() * tiles, 1, [&](size_t b, size_t e) {
+        for (auto work = b; work < e; work++) {
+            auto f = work / tiles;
+            auto& state = *frames[f];
+            std::call_once(state.allocated, [&] {
+                state.pixels.assign(static_cast<size_t>(width) * height, color(0, 0, 0));
+                state.pixel_bytes.set(state.pixels.size() * sizeof(color));
+            });
+
+            render_tile(cameras[f], culler, static_cast<int>(work % tiles), state.pixels);
+
+            if (state.remaining.fetch_sub(1) == 1) {
+                write_frame(filename_pattern, static_cast<int>(f), state.pixels);
+                std::vector<color>().swap(state.pixels);
+                state.pixel_bytes.set(0);
+                std::cerr << "\rFrames done: " << ++written << '/' << cameras.size() << ' ' << std::flush;
+            }
+        }
+    });
+    std::cerr << '\n';
+}
+
+
+void batch_renderer::render_animation(
+    int frames, const std::function<camera(int)>& camera_at,
+    const std::function<void(int)>& animate, const char* filename_pattern, thread_pool& pool
+) {
+    // Two buffers: one being written out while the other is rendered.
+    std::vector<color> buffers[2];
+    memory_charge buffer_bytes(memory_tag::framebuffers, 2 * sizeof(color) * width * height);
+    std::future<void> writing;
+    auto tiles = tiles_per_frame();
+
+    for (int f = 0; f < frames; f++) {
+        animate(f);
+        bvh.refit();
+        auto cam = camera_at(f);
+        tile_culler culler(bvh);
+
+        auto& pixels = buffers[f % 2];
+        pixels.resize(static_cast<size_t>(width) * height);
+        pool.parallel_for(0, tiles, 1, [&](size_t b, size_t e) {
+            for (auto tile = b; tile < e; tile++)
+                render_tile(cam, culler, static_cast<int>(tile), pixels);
+        });
+
+        if (writing.valid())
+            writing.get();
+        writing = pool.async([this, filename_pattern, f, &pixels] {
+            write_frame(filename_pattern, f, pixels);
+        });
+        std::cerr << "\rFrames done: " << f + 1 << '/' << frames << ' ' << std::flush;
+    }
+
+    if (writing.valid())
+        writing.get();
+    std::cerr << '\n';
+}
+
+
+#endif
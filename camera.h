@@ -3,6 +3,8 @@
 
 #include "rtweekend.h"
 
+#include "aabb.h"
+
 class camera {
     public:
         camera(
@@ -42,6 +44,10 @@ class camera {
             );
         }
 
+        // True when no ray get_ray(s, t) can make for s in [s0, s1] and t in [t0, t1],
+        // from anywhere on the lens, reaches `box`. Conservative: false when unsure.
+        bool misses(const aabb& box, double s0, double s1, double t0, double t1) const;
+
     private:
         point3 origin;
         point3 lower_left_corner;
@@ -51,4 +57,58 @@ class camera {
         double lens_radius;
 };
 
+
+// In camera coordinates (x along u, y along v, depth d along -w), a ray leaves the lens at
+// (ox, oy, 0), |ox|, |oy| <= lens_radius, and crosses the focus plane d = f inside the
+// rectangle of [s0, s1] x [t0, t1]. At relative depth k = d/f its x is ox*(1-k) + k*fx,
+// so x >= k*x0 - lens_radius*|k-1|, and likewise on the other three sides. Each bound
+// cuts space into a convex region no ray enters. Only the part of the box in front of
+// the lens (k >= 0) matters: it is missed when the corners of that part all lie in one
+// of the regions.
+bool camera::misses(const aabb& box, double s0, double s1, double t0, double t1) const {
+    auto focus = dot(origin - lower_left_corner, w);
+    auto corner = lower_left_corner - origin;
+    auto x0 = dot(corner + s0*horizontal, u), x1 = dot(corner + s1*horizontal, u);
+    auto y0 = dot(corner + t0*vertical, v), y1 = dot(corner + t1*vertical, v);
+
+    // Box corners as (x, y, k), then the front part: corners with k >= 0 and the points
+    // where edges cross k = 0.
+    vec3 corners[8];
+    for (int c = 0; c < 8; c++) {
+        point3 p((c & 1 ? box.max() : box.min()).x(),
+                 (c & 2 ? box.max() : box.min()).y(),
+                 (c & 4 ? box.max() : box.min()).z());
+        auto d = p - origin;
+        corners[c] = vec3(dot(d, u), dot(d, v), -dot(d, w) / focus);
+    }
+    vec3 front[20];
+    int count = 0;
+    for (int c = 0; c < 8; c++) {
+        if (corners[c].z() >= 0)
+            front[count++] = corners[c];
+        for (int axis = 1; axis < 8; axis <<= 1) {
+            auto other = c | axis;
+            if (other == c)
+                continue;
+            auto ka = corners[c].z(), kb = corners[other].z();
+            if ((ka < 0) != (kb < 0)) {
+                auto f = ka / (ka - kb);
+                front[count++] = corners[c] + f * (corners[other] - corners[c]);
+            }
+        }
+    }
+
+    bool left = true, right = true, below = true, above = true;
+    for (int i = 0; i < count; i++) {
+        auto x = front[i].x(), y = front[i].y(), k = std::max(front[i].z(), 0.0);
+        auto spread = lens_radius * fabs(k - 1);
+        left = left && x < k*x0 - spread;
+        right = right && x > k*x1 + spread;
+        below = below && y < k*y0 - spread;
+        above = above && y > k*y1 + spread;
+    }
+    return left || right || below || above;
+}
+
+
 #endif
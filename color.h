@@ -1,11 +1,13 @@
 #ifndef COLOR_H
 #define COLOR_H
 
+#include "perf_counters.h"
 #include "vec3.h"
 
 #include <iostream>
 
 void write_color(std::ostream &out, color pixel_color, int samples_per_pixel) {
+   perf_phase phase(render_phase::output);
    auto r = pixel_color.x();
    auto g = pixel_color.y();
    auto b = pixel_color.z();
@@ -17,6 +17,8 @@ class cylinder : public hittable {
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool bounding_box(aabb& output_box) const override;
+
     public:
         point3 center;
         double radius;
@@ -36,7 +38,7 @@ bool cylinder::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
     
     auto b = 2*o[0]*d[0] - 2*f[0]*d[0] + 2*o[2]*d[2] - 2*f[2]*d[2];
 
-    auto c = o[0]*o[0] - 2*o[0]*f[0] - f[0]*f[0] + o[2]*o[2] - 2*o[2]*f[2] - f[2]*f[2] - radius*radius;
+    auto c = (o[0] - f[0])*(o[0] - f[0]) + (o[2] - f[2])*(o[2] - f[2]) - radius*radius;
 
     auto discriminant = b*b - 4*a*c;
     if (discriminant < 0) return false;
@@ -58,7 +60,17 @@ bool cylinder::hit(const ray& r, double t_min, double t_max, hit_record& rec) co
     rec.p = r.at(rec.t);
 
     rec.mat_ptr = mat_ptr;
+    rec.object = this;
+
+    return true;
+}
+
 
+bool cylinder::bounding_box(aabb& output_box) const {
+    // The hit test clips against y in [-height/2, height/2] in world space.
+    output_box = aabb(
+        point3(center.x() - radius, -height/2, center.z() - radius),
+        point3(center.x() + radius,  height/2, center.z() + radius));
     return true;
 }
 
@@ -0,0 +1,42 @@
+#include "rtweekend.h"
+
+#include "cylinder.h"
+#include "hittable_list.h"
+#include "qbvh.h"
+
+#include <iostream>
+
+
+// Confere que cilindros fora da origem sao atingidos pelos mesmos raios com e sem a qbvh,
+// ou seja, que a caixa do cilindro contem a superficie que cylinder::hit intersecta:
+//
+//     g++ -std=c++17 -O2 -pthread cylinder_test.cpp -o cylinder_test && ./cylinder_test
+//
+// Sai com 1 se algum raio der resultado diferente.
+
+int main() {
+    hittable_list world;
+    world.add(make_shared<cylinder>(point3(0, 0, 0), 1.5, 4, nullptr));
+    world.add(make_shared<cylinder>(point3(6, 0, -3), 1.0, 3, nullptr));
+    world.add(make_shared<cylinder>(point3(-5, 0, 4), 2.0, 2, nullptr));
+    world.add(make_shared<cylinder>(point3(30, 0, 25), 0.5, 6, nullptr));
+    qbvh bvh(world);
+
+    long long mismatches = 0, hits = 0;
+    const int count = 2000000;
+    for (int i = 0; i < count; i++) {
+        point3 from(random_double(-40, 40), random_double(-4, 4), random_double(-40, 40));
+        point3 to(random_double(-8, 32), random_double(-3, 3), random_double(-6, 27));
+        ray r(from, to - from);
+
+        hit_record linear, tree;
+        auto a = world.hit(r, 0.001, infinity, linear);
+        auto b = bvh.hit(r, 0.001, infinity, tree);
+        hits += a;
+        if (a != b || (a && (linear.t != tree.t || linear.object != tree.object)))
+            mismatches++;
+    }
+
+    std::cerr << count << " rays, " << hits << " hits, " << mismatches << " mismatches (bound 0)\n";
+    return mismatches ? 1 : 0;
+}
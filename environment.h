@@ -0,0 +1,146 @@
+#ifndef ENVIRONMENT_H
+#define ENVIRONMENT_H
+
+#include "rtweekend.h"
+
+#include "rtw_stb_image.h"
+
+#include <algorithm>
+#include <iostream>
+#include <vector>
+
+
+// Luz de fundo da cena. Sem imagem, e o gradiente branco/azul de sempre. Com uma imagem
+// equiretangular (HDR ou LDR, lida pelo stb_image em cores lineares), constroi uma CDF 2D
+// sobre os pixels para que a iluminacao direta possa amostrar as regioes mais brilhantes.
+class environment {
+    public:
+        environment() {}
+
+        environment(const char* filename, double intensity = 1.0) : scale(intensity) {
+            auto components = 3;
+            auto pixels = stbi_loadf(filename, &width, &height, &components, 3);
+
+            if (!pixels) {
+                std::cerr << "ERROR: Could not load environment map '" << filename << "'.\n";
+                width = height = 0;
+                return;
+            }
+
+            data.assign(pixels, pixels + 3*width*height);
+            STBI_FREE(pixels);
+
+            build_distribution();
+        }
+
+        // Environment maps are sampled directly; the gradient is only found by escaping rays.
+        bool importance_sampled() const { return !data.empty(); }
+
+        color value(const vec3& direction) const {
+            if (data.empty()) {
+                vec3 unit_direction = unit_vector(direction);
+                auto t = 0.5*(unit_direction.y() + 1.0);
+                return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
+            }
+
+            double u, v;
+            direction_to_uv(unit_vector(direction), u, v);
+            auto i = std::min(static_cast<int>(u * width), width-1);
+            auto j = std::min(static_cast<int>(v * height), height-1);
+            auto pixel = &data[3*(j*width + i)];
+
+            return scale * color(pixel[0], pixel[1], pixel[2]);
+        }
+
+        // Solid-angle pdf with which sample() returns direction.
+        double pdf_value(const vec3& direction) const {
+            if (data.empty())
+                return 0;
+
+            double u, v;
+            direction_to_uv(unit_vector(direction), u, v);
+            auto i = std::min(static_cast<int>(u * width), width-1);
+            auto j = std::min(static_cast<int>(v * height), height-1);
+
+            auto sin_theta = sin(v * pi);
+            if (sin_theta <= 0)
+                return 0;
+
+            // Density over (u,v) in [0,1]^2, then the Jacobian of the spherical mapping.
+            auto pdf_uv = pixel_pdf(i, j) * width * height;
+            return pdf_uv / (2*pi*pi*sin_theta);
+        }
+
+        vec3 sample() const {
+            auto j = sample_cdf(marginal_cdf, 0, height, random_double());
+            auto i = sample_cdf(conditional_cdf, j*(width+1), width, random_double());
+
+            auto u = (i + random_double()) / width;
+            auto v = (j + random_double()) / height;
+            return uv_to_direction(u, v);
+        }
+
+    private:
+        // +y is the top row of the image, u wraps around the vertical axis.
+        static void direction_to_uv(const vec3& d, double& u, double& v) {
+            u = 0.5 + atan2(d.x(), -d.z()) / (2*pi);
+            v = acos(clamp(d.y(), -1.0, 1.0)) / pi;
+        }
+
+        static vec3 uv_to_direction(double u, double v) {
+            auto theta = v * pi;
+            auto phi = (u - 0.5) * 2*pi;
+            return vec3(sin(theta)*sin(phi), cos(theta), -sin(theta)*cos(phi));
+        }
+
+        double pixel_pdf(int i, int j) const {
+            if (total_weight <= 0)
+                return 0;
+            return weights[j*width + i] / total_weight;
+        }
+
+        void build_distribution() {
+            // Luminance weighted by sin(theta), so rows near the poles, which cover less
+            // solid angle, are picked less often.
+            weights.resize(width*height);
+            conditional_cdf.assign(height*(width+1), 0.0);
+            marginal_cdf.assign(height+1, 0.0);
+
+            for (int j = 0; j < height; j++) {
+                auto sin_theta = sin((j + 0.5) / height * pi);
+                auto row = &conditional_cdf[j*(width+1)];
+
+                for (int i = 0; i < width; i++) {
+                    auto pixel = &data[3*(j*width + i)];
+                    auto luminance = 0.2126*pixel[0] + 0.7152*pixel[1] + 0.0722*pixel[2];
+                    weights[j*width + i] = luminance * sin_theta;
+                    row[i+1] = row[i] + weights[j*width + i];
+                }
+
+                marginal_cdf[j+1] = marginal_cdf[j] + row[width];
+            }
+
+            total_weight = marginal_cdf[height];
+        }
+
+        // Index of the bucket of an unnormalized CDF with `count` buckets that holds xi.
+        static int sample_cdf(const std::vector<double>& cdf, int offset, int count, double xi) {
+            auto first = cdf.begin() + offset;
+            auto target = xi * first[count];
+            auto it = std::upper_bound(first + 1, first + count + 1, target);
+            auto index = static_cast<int>(it - first) - 1;
+            return std::min(std::max(index, 0), count-1);
+        }
+
+    private:
+        std::vector<float> data;
+        std::vector<double> weights;
+        std::vector<double> conditional_cdf;  // one (width+1)-entry CDF per row
+        std::vector<double> marginal_cdf;     // over rows
+        double total_weight = 0;
+        double scale = 1.0;
+        int width = 0, height = 0;
+};
+
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef RT_FAST_MATH
+#define RT_FAST_MATH
+#endif
+#include "fast_math.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+
+
+// Confere os limites de erro documentados em fast_math.h contra a libm:
+//
+//     g++ -std=c++17 -O2 fast_math_test.cpp -o fast_math_test && ./fast_math_test
+//
+// Sai com 1 se algum limite for ultrapassado.
+
+static int64_t ordered(double x) {
+    int64_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    return bits < 0 ? INT64_MIN - bits : bits;
+}
+
+static int64_t ulp_distance(double a, double b) {
+    auto d = ordered(a) - ordered(b);
+    return d < 0 ? -d : d;
+}
+
+// Deterministic uniform values in [0, 1).
+static double next_unit(uint64_t& state) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    return (state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+int main() {
+    int failed = 0;
+    uint64_t state = 1;
+
+    // fast_sin: a dense sweep near zero, where the argument reduction does nothing, then
+    // random points over the whole range.
+    double sin_error = 0, sin_worst = 0;
+    auto check_sin = [&](double x) {
+        auto e = std::fabs(fast_sin(x) - std::sin(x));
+        if (e > sin_error) {
+            sin_error = e;
+            sin_worst = x;
+        }
+    };
+    for (double x = -100; x <= 100; x += 1e-4)
+        check_sin(x);
+    for (int i = 0; i < 20000000; i++)
+        check_sin((2 * next_unit(state) - 1) * 1e6);
+    for (auto x : {0.0, -0.0, 1e6, -1e6, 1.5707963267948966, 3.141592653589793, 999999.9999999999})
+        check_sin(x);
+    std::cerr << "fast_sin   max abs error " << sin_error << " at " << sin_worst << " (bound 1e-9)\n";
+    if (sin_error >= 1e-9)
+        failed++;
+
+    // fast_floor: every scale up to 2^52, with values at and around the integers. Only the
+    // value is compared: -0 comes out as +0.
+    long long floor_mismatches = 0;
+    auto check_floor = [&](double x) {
+        if (fast_floor(x) != std::floor(x))
+            floor_mismatches++;
+    };
+    for (int e = -20; e < 52; e++) {
+        auto scale = std::ldexp(1.0, e);
+        for (int i = 0; i < 100000; i++) {
+            auto x = (2 * next_unit(state) - 1) * scale;
+            check_floor(x);
+            check_floor(std::round(x));
+            check_floor(std::nextafter(std::round(x), INFINITY));
+            check_floor(std::nextafter(std::round(x), -INFINITY));
+        }
+    }
+    for (auto x : {0.0, -0.0, 0.5, -0.5, 4503599627370495.5, -4503599627370495.5, 4503599627370496.0})
+        check_floor(x);
+    std::cerr << "fast_floor " << floor_mismatches << " mismatches (bound 0)\n";
+    if (floor_mismatches != 0)
+        failed++;
+
+    // pow5 over the range the Fresnel term uses and well beyond it.
+    int64_t pow_ulp = 0;
+    for (int i = 0; i < 10000000; i++) {
+        auto x = (2 * next_unit(state) - 1) * 100;
+        pow_ulp = std::max(pow_ulp, ulp_distance(pow5(x), std::pow(x, 5)));
+    }
+    for (double x = 0; x <= 1; x += 1e-6)
+        pow_ulp = std::max(pow_ulp, ulp_distance(pow5(x), std::pow(x, 5)));
+    std::cerr << "pow5       max error " << pow_ulp << " ulp (bound 3)\n";
+    if (pow_ulp > 3)
+        failed++;
+
+    return failed ? 1 : 0;
+}
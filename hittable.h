@@ -13,6 +13,8 @@
 
 #include "rtweekend.h"
 
+#include "aabb.h"
+
 class material;
 
 
@@ -24,6 +26,7 @@ struct hit_record {
     double u;
     double v;
     bool front_face;
+    const void* object = nullptr;  // primitive that was hit, to tell objects apart
 
     inline void set_face_normal(const ray& r, const vec3& outward_normal) {
         front_face = dot(r.direction(), outward_normal) < 0;
@@ -32,10 +35,101 @@ struct hit_record {
 };
 
 
+// What hittable::closest_hit reports: no shading data and no shared_ptr, so finding it
+// touches no reference count.
+struct hit_summary {
+    double t;
+    const void* object = nullptr;     // as in hit_record::object
+    const material* mat = nullptr;
+};
+
+
 class hittable {
     public:
         virtual bool hit(const ray& r, double t_min, double t_max, hit_record& rec) const = 0;
+        virtual bool bounding_box(aabb& output_box) const = 0;
+
+        // Any-hit query for shadow rays: true as soon as something blocks the segment,
+        // without filling a hit_record.
+        virtual bool occluded(const ray& r, double t_min, double t_max) const {
+            hit_record rec;
+            return hit(r, t_min, t_max, rec);
+        }
+
+        // Closest hit without normal, uv or a material shared_ptr, for queries that do not
+        // shade; `out` is left alone on a miss. Primitives that do not override it go
+        // through hit().
+        virtual bool closest_hit(const ray& r, double t_min, double t_max, hit_summary& out) const {
+            hit_record rec;
+            if (!hit(r, t_min, t_max, rec))
+                return false;
+            out.t = rec.t;
+            out.object = rec.object;
+            out.mat = rec.mat_ptr.get();
+            return true;
+        }
+
+        // Light sampling: solid-angle pdf of direction v seen from o, and a direction
+        // from o drawn with that pdf.
+        virtual double pdf_value(const point3& o, const vec3& v) const {
+            return 0.0;
+        }
+
+        virtual vec3 random(const point3& o) const {
+            return vec3(1, 0, 0);
+        }
 };
 
 
+// Moves an object by `offset`; changing the offset between frames animates it.
+class translate : public hittable {
+    public:
+        translate(shared_ptr<hittable> p, const vec3& displacement)
+            : ptr(p), offset(displacement) {}
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        virtual bool bounding_box(aabb& output_box) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override {
+            return ptr->occluded(ray(r.origin() - offset, r.direction()), t_min, t_max);
+        }
+
+        virtual bool closest_hit(const ray& r, double t_min, double t_max, hit_summary& out) const override {
+            if (!ptr->closest_hit(ray(r.origin() - offset, r.direction()), t_min, t_max, out))
+                return false;
+            out.object = this;
+            return true;
+        }
+
+    public:
+        shared_ptr<hittable> ptr;
+        vec3 offset;
+};
+
+bool translate::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    ray moved_r(r.origin() - offset, r.direction());
+    if (!ptr->hit(moved_r, t_min, t_max, rec))
+        return false;
+
+    rec.p += offset;
+    rec.set_face_normal(moved_r, rec.normal);
+    rec.object = this;  // moving the translate is what edits the object
+
+    return true;
+}
+
+bool translate::bounding_box(aabb& output_box) const {
+    if (!ptr->bounding_box(output_box))
+        return false;
+
+    output_box = aabb(
+        output_box.min() + offset,
+        output_box.max() + offset);
+
+    return true;
+}
+
+
 #endif
@@ -30,6 +30,16 @@ class hittable_list : public hittable  {
         virtual bool hit(
             const ray& r, double t_min, double t_max, hit_record& rec) const override;
 
+        virtual bool bounding_box(aabb& output_box) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool closest_hit(const ray& r, double t_min, double t_max, hit_summary& out) const override;
+
+        // As a light list: picks one of the objects uniformly.
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 random(const point3& o) const override;
+
     public:
         std::vector<shared_ptr<hittable>> objects;
 };
@@ -52,4 +62,59 @@ bool hittable_list::hit(const ray& r, double t_min, double t_max, hit_record& re
 }
 
 
+bool hittable_list::closest_hit(const ray& r, double t_min, double t_max, hit_summary& out) const {
+    auto hit_anything = false;
+    for (const auto& object : objects) {
+        if (object->closest_hit(r, t_min, t_max, out)) {
+            hit_anything = true;
+            t_max = out.t;
+        }
+    }
+    return hit_anything;
+}
+
+
+bool hittable_list::occluded(const ray& r, double t_min, double t_max) const {
+    for (const auto& object : objects)
+        if (object->occluded(r, t_min, t_max))
+            return true;
+    return false;
+}
+
+
+double hittable_list::pdf_value(const point3& o, const vec3& v) const {
+    if (objects.empty()) return 0.0;
+
+    auto weight = 1.0/objects.size();
+    auto sum = 0.0;
+
+    for (const auto& object : objects)
+        sum += weight * object->pdf_value(o, v);
+
+    return sum;
+}
+
+
+vec3 hittable_list::random(const point3& o) const {
+    auto int_size = static_cast<int>(objects.size());
+    return objects[random_int(0, int_size-1)]->random(o);
+}
+
+
+bool hittable_list::bounding_box(aabb& output_box) const {
+    if (objects.empty()) return false;
+
+    aabb temp_box;
+    bool first_box = true;
+
+    for (const auto& object : objects) {
+        if (!object->bounding_box(temp_box)) return false;
+        output_box = first_box ? temp_box : surrounding_box(output_box, temp_box);
+        first_box = false;
+    }
+
+    return true;
+}
+
+
 #endif
@@ -0,0 +1,161 @@
+#ifndef IMAGE_STREAM_H
+#define IMAGE_STREAM_H
+
+#include "rtweekend.h"
+
+#include "memory_stats.h"
+#include "perf_counters.h"
+#include "thread_pool.h"
+#include "tile_profiler.h"
+#include "vec3.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+
+// Renderizacao em faixas para imagens muito grandes.
+//
+// A imagem e dividida em faixas de tile_size linhas, e cada faixa em tiles de tile_size
+// colunas. Os tiles de uma faixa sao renderizados em paralelo e a faixa e gravada no
+// arquivo assim que termina, na ordem do formato; so uma faixa fica na memoria. O
+// arquivo e um PPM binario (P6, com correcao gamma como write_color) ou um PFM com a
+// radiancia linear em float.
+
+enum class image_format { ppm, pfm };
+
+
+// Writes an image strip by strip, in file order.
+class image_stream {
+    public:
+        image_stream(const char* filename, image_format f, int w, int h, int spp)
+            : format(f), width(w), height(h), samples_per_pixel(spp) {
+            file = fopen(filename, "wb");
+            if (!file) {
+                std::cerr << "ERROR: Could not open image file '" << filename << "'.\n";
+                return;
+            }
+            if (format == image_format::ppm) {
+                fprintf(file, "P6\n%d %d\n255\n", width, height);
+            } else {
+                // A negative scale marks little-endian floats.
+                uint16_t probe = 1;
+                auto little_endian = *reinterpret_cast<uint8_t*>(&probe) == 1;
+                fprintf(file, "PF\n%d %d\n%s\n", width, height, little_endian ? "-1.0" : "1.0");
+            }
+        }
+
+        ~image_stream() {
+            if (file)
+                fclose(file);
+        }
+
+        image_stream(const image_stream&) = delete;
+        image_stream& operator=(const image_stream&) = delete;
+
+        bool good() const { return file && !failed; }
+
+        int samples() const { return samples_per_pixel; }
+
+        // PPM stores the top row first, PFM the bottom row first.
+        bool bottom_up() const { return format == image_format::pfm; }
+
+        // Writes `rows` rows of summed samples, already in file order.
+        void write_rows(const std::vector<color>& pixels, int rows) {
+            if (!file)
+                return;
+
+            perf_phase phase(render_phase::output);
+            auto count = static_cast<size_t>(rows) * width;
+            auto scale = 1.0 / samples_per_pixel;
+            size_t written;
+
+            if (format == image_format::ppm) {
+                bytes.resize(3 * count);
+                for (size_t i = 0; i < count; i++)
+                    for (int c = 0; c < 3; c++)
+                        bytes[3*i + c] = static_cast<uint8_t>(
+                            256 * clamp(sqrt(scale * pixels[i][c]), 0.0, 0.999));
+                written = fwrite(bytes.data(), 3, count, file);
+            } else {
+                floats.resize(3 * count);
+                for (size_t i = 0; i < count; i++)
+                    for (int c = 0; c < 3; c++)
+                        floats[3*i + c] = static_cast<float>(scale * pixels[i][c]);
+                written = fwrite(floats.data(), 3 * sizeof(float), count, file);
+            }
+
+            if (written != count && !failed) {
+                std::cerr << "ERROR: Could not write image rows.\n";
+                failed = true;
+            }
+        }
+
+    private:
+        FILE* file = nullptr;
+        bool failed = false;
+        image_format format;
+        int width, height;
+        int samples_per_pixel;
+        std::vector<uint8_t> bytes;
+        std::vector<float> floats;
+};
+
+
+// Renders the image strip by strip into `out`. sample(i, j) returns the sum of the
+// samples for pixel (i, j), with j = 0 the bottom row as in main(); it is called from
+// the pool's threads. With a profiler, every tile's time is recorded.
+void render_streaming(
+    image_stream& out, int width, int height, int tile_size,
+    const std::function<color(int, int)>& sample, tile_profiler* profiler = nullptr,
+    thread_pool& pool = default_thread_pool()
+) {
+    tile_size = std::max(tile_size, 1);
+    std::vector<color> strip(static_cast<size_t>(tile_size) * width);
+    memory_charge strip_bytes(memory_tag::framebuffers, strip.size() * sizeof(color));
+    auto tiles_across = (width + tile_size - 1) / tile_size;
+    auto tiles_down = (height + tile_size - 1) / tile_size;
+
+    for (int first = 0; first < height; first += tile_size) {
+        auto rows = std::min(tile_size, height - first);
+        std::cerr << "\rRows remaining: " << height - first << ' ' << std::flush;
+
+        // Row r of the strip is image row j(r), counted in file order.
+        auto row_of = [&](int r) {
+            auto k = first + r;
+            return out.bottom_up() ? k : height - 1 - k;
+        };
+
+        // Where the strip sits in the tile grid and in pixels, both counted from the top.
+        auto strip_index = first / tile_size;
+        auto grid_row = out.bottom_up() ? tiles_down - 1 - strip_index : strip_index;
+        auto top = out.bottom_up() ? height - first - rows : first;
+
+        pool.parallel_for(0, tiles_across, 1, [&](size_t b, size_t e) {
+            for (auto tile = b; tile < e; tile++) {
+                auto start = profiler ? profiler->now() : 0.0;
+                auto x0 = static_cast<int>(tile) * tile_size;
+                auto x1 = std::min(x0 + tile_size, width);
+                for (int r = 0; r < rows; r++) {
+                    auto j = row_of(r);
+                    for (int i = x0; i < x1; i++)
+                        strip[static_cast<size_t>(r) * width + i] = sample(i, j);
+                }
+                if (profiler)
+                    profiler->record(static_cast<int>(tile), grid_row, x0, top, x1 - x0, rows,
+                                     static_cast<long>(x1 - x0) * rows * out.samples(),
+                                     start, profiler->now());
+            }
+        });
+
+        out.write_rows(strip, rows);
+        if (!out.good())
+            return;
+    }
+}
+
+
+#endif
@@ -0,0 +1,244 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "color.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "material_table.h"
+#include "memory_stats.h"
+#include "perf_counters.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <vector>
+
+
+// Re-renderizacao incremental.
+//
+// Para cada pixel guardamos a lista ordenada das chaves (id_set) dos objetos e materiais
+// que os caminhos dele atingiram nos primeiros quiques, e tambem, nas amostras diretas de
+// luz desses quiques, a luz atingida (objeto e material) e o objeto que fez sombra. As
+// listas de uma linha ficam num vetor so, com um vetor de inicios. Depois de editar a
+// cena, update() refaz so os pixels cuja lista tem a chave de algum objeto ou material
+// alterado, e mantem o resto da imagem. Um pixel com mais de max_ids chaves nao guarda
+// lista nenhuma e e refeito a cada update(). So uma colisao de chaves faz um pixel ser
+// refeito a toa; um pixel que usou o objeto alterado nunca fica de fora.
+//
+// Para objetos que mudaram de lugar, os pixels cujo raio de camera passa pela caixa da
+// nova posicao tambem sao refeitos. Se um dos objetos alterados for uma luz, a imagem
+// inteira e refeita, pois a amostragem direta de todo pixel depende dela. O que fica de
+// fora: efeitos indiretos da nova posicao em pixels que antes nao viam o objeto
+// (reflexos e sombras novos), as causticas do mapa de fotons, e quiques alem de
+// tracked_bounces.
+
+
+// ray_color that also notes the objects and materials hit in the first bounces, and the
+// lights and shadow casters their direct light samples used.
+color ray_color_tracked(
+    const ray& r, const hittable& world, const light_set& lights, int depth,
+    const material_table* materials, int tracked_bounces, id_set& touched
+) {
+    if (depth <= 0)
+        return color(0,0,0);
+
+    auto path = camera_path(r, depth);
+    perf_phase phase(render_phase::primary_rays);
+    for (int bounce = 0; ; bounce++) {
+        if (bounce == 1)
+            phase.change(render_phase::secondary_bounces);
+        hit_record rec;
+        if (!world.hit(path.r, 0.001, infinity, rec)) {
+            shade_miss(path, lights);
+            break;
+        }
+        auto tracked = bounce < tracked_bounces;
+        if (tracked) {
+            touched.add(rec.object);
+            touched.add(rec.mat_ptr.get());
+        }
+        if (!shade_hit(path, rec, world, lights, materials, tracked ? &touched : nullptr))
+            break;
+    }
+
+    return path.radiance;
+}
+
+
+class incremental_renderer {
+    public:
+        incremental_renderer(int w, int h, int spp, int depth, int bounces = 3)
+            : width(w), height(h), samples_per_pixel(spp), max_depth(depth), tracked_bounces(bounces),
+              sum(static_cast<size_t>(w) * h, color(0, 0, 0)), rows(h, row_ids{std::vector<uint32_t>(w + 1, 0), {}}),
+              everything(static_cast<size_t>(w) * h, 1), last_dirty(static_cast<size_t>(w) * h, 0),
+              buffer_bytes(memory_tag::framebuffers) {}
+
+        // Renders every pixel.
+        void render(
+            const camera& cam, const hittable& world, const light_set& lights,
+            const material_table* materials, thread_pool& pool = default_thread_pool()
+        ) {
+            std::vector<char> all(sum.size(), 1);
+            render_pixels(all, cam, world, lights, materials, pool);
+        }
+
+        // Re-renders the pixels that may see a change. `changed` lists the edited objects
+        // (as set in hit_record::object) and materials, `moved` the new bounds of objects
+        // that moved. Returns the number of pixels rendered again.
+        size_t update(
+            const camera& cam, const hittable& world, const light_set& lights,
+            const material_table* materials, const std::vector<const void*>& changed,
+            const std::vector<aabb>& moved, thread_pool& pool = default_thread_pool()
+        );
+
+        // True if the last render() or update() rendered pixel (i, j) again.
+        bool rendered_again(int i, int j) const { return last_dirty[index(i, j)]; }
+
+        // Plain-text PPM, the top row first, like main() writes.
+        void write(std::ostream& out) const {
+            out << "P3\n" << width << ' ' << height << "\n255\n";
+            for (int j = height-1; j >= 0; --j)
+                for (int i = 0; i < width; ++i)
+                    write_color(out, sum[index(i, j)], samples_per_pixel);
+        }
+
+    private:
+        // The keys of a row's pixels: pixel i owns keys[offsets[i] .. offsets[i+1]).
+        struct row_ids {
+            std::vector<uint32_t> offsets;
+            std::vector<uint32_t> keys;
+        };
+
+        // Pixels with more keys than this are rendered again by every update().
+        static const size_t max_ids = 64;
+
+        size_t index(int i, int j) const { return static_cast<size_t>(j) * width + i; }
+
+        // True if pixel i of row j may have used the object or material with key `k`.
+        bool uses(int i, int j, uint32_t k) const {
+            const auto& row = rows[j];
+            return everything[index(i, j)]
+                || std::binary_search(row.keys.begin() + row.offsets[i], row.keys.begin() + row.offsets[i+1], k);
+        }
+
+        void render_pixels(
+            const std::vector<char>& dirty, const camera& cam, const hittable& world,
+            const light_set& lights, const material_table* materials, thread_pool& pool);
+
+    private:
+        int width, height;
+        int samples_per_pixel;
+        int max_depth;
+        int tracked_bounces;
+        std::vector<color> sum;
+        std::vector<row_ids> rows;
+        std::vector<char> everything;   // the pixel had more than max_ids keys
+        std::vector<char> last_dirty;
+        memory_charge buffer_bytes;
+};
+
+
+void incremental_renderer::render_pixels(
+    const std::vector<char>& dirty, const camera& cam, const hittable& world,
+    const light_set& lights, const material_table* materials, thread_pool& pool
+) {
+    last_dirty = dirty;
+
+    // Each row's keys are rebuilt, copying the lists of the pixels that stay.
+    pool.parallel_for(0, height, 1, [&](size_t b, size_t e) {
+        for (auto j = static_cast<int>(b); j < static_cast<int>(e); j++) {
+            const auto& old = rows[j];
+            row_ids row;
+            row.offsets.reserve(width + 1);
+            row.keys.reserve(old.keys.size());
+            row.offsets.push_back(0);
+            for (int i = 0; i < width; ++i) {
+                auto k = index(i, j);
+                if (!dirty[k]) {
+                    row.keys.insert(row.keys.end(), old.keys.begin() + old.offsets[i], old.keys.begin() + old.offsets[i+1]);
+                    row.offsets.push_back(static_cast<uint32_t>(row.keys.size()));
+                    continue;
+                }
+
+                color pixel_color(0, 0, 0);
+                id_set ids;
+                for (int s = 0; s < samples_per_pixel; ++s) {
+                    auto u = (i + random_double()) / (width-1);
+                    auto v = (j + random_double()) / (height-1);
+                    pixel_color += ray_color_tracked(cam.get_ray(u, v), world, lights, max_depth,
+                                                     materials, tracked_bounces, ids);
+                }
+                sum[k] = pixel_color;
+
+                ids.compact();
+                everything[k] = ids.keys.size() > max_ids;
+                if (!everything[k])
+                    row.keys.insert(row.keys.end(), ids.keys.begin(), ids.keys.end());
+                row.offsets.push_back(static_cast<uint32_t>(row.keys.size()));
+            }
+            rows[j] = std::move(row);
+        }
+    });
+
+    auto bytes = sum.size() * (sizeof(color) + 2 * sizeof(char));
+    for (const auto& row : rows)
+        bytes += (row.offsets.capacity() + row.keys.capacity()) * sizeof(uint32_t);
+    buffer_bytes.set(bytes);
+}
+
+
+size_t incremental_renderer::update(
+    const camera& cam, const hittable& world, const light_set& lights,
+    const material_table* materials, const std::vector<const void*>& changed,
+    const std::vector<aabb>& moved, thread_pool& pool
+) {
+    std::vector<uint32_t> changed_keys;
+    for (auto id : changed)
+        changed_keys.push_back(id_set::key(id));
+
+    // Editing a light object itself changes where every pixel samples light, not only
+    // the samples that reached it, so everything is rendered again.
+    auto light_changed = false;
+    for (const auto& light : lights.lights.objects)
+        for (auto id : changed)
+            light_changed = light_changed || light.get() == id;
+    if (light_changed) {
+        std::vector<char> all(sum.size(), 1);
+        render_pixels(all, cam, world, lights, materials, pool);
+        return all.size();
+    }
+
+    // Old paths through a changed object, or camera rays through a new position; the
+    // camera test uses the pixel's corners and center.
+    std::vector<char> dirty(sum.size(), 0);
+    pool.parallel_for(0, height, 1, [&](size_t b, size_t e) {
+        for (auto j = static_cast<int>(b); j < static_cast<int>(e); j++) {
+            for (int i = 0; i < width; ++i) {
+                auto k = index(i, j);
+                for (auto key : changed_keys)
+                    dirty[k] = dirty[k] || uses(i, j, key);
+
+                for (int corner = 0; corner < 5 && !dirty[k] && !moved.empty(); corner++) {
+                    auto du = corner == 4 ? 0.5 : (corner & 1), dv = corner == 4 ? 0.5 : (corner >> 1);
+                    auto r = cam.get_ray((i + du) / (width-1), (j + dv) / (height-1));
+                    for (const auto& box : moved)
+                        dirty[k] = dirty[k] || box.hit(r, 0.001, infinity);
+                }
+            }
+        }
+    });
+
+    size_t count = 0;
+    for (auto d : dirty)
+        count += d;
+
+    render_pixels(dirty, cam, world, lights, materials, pool);
+    return count;
+}
+
+
+#endif
@@ -0,0 +1,93 @@
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "environment.h"
+#include "hittable_list.h"
+#include "incremental.h"
+#include "material.h"
+#include "material_table.h"
+#include "qbvh.h"
+#include "sphere.h"
+
+#include <algorithm>
+#include <iostream>
+
+
+// Confere que editar um objeto numa cena cheia refaz so uma pequena parte da imagem, e
+// que todo pixel cujo raio de camera atinge o objeto editado esta entre os refeitos:
+//
+//     g++ -std=c++17 -O2 -pthread incremental_test.cpp -o incremental_test && ./incremental_test
+//
+// A cena e uma grade apertada de 1600 esferas, cada uma com o seu material, e oito luzes
+// pequenas, entao cada pixel anota dezenas de objetos. O teste troca o material de varias
+// esferas, uma por vez, e sai com 1 se alguma edicao refizer mais de 10% dos pixels ou
+// se faltar algum pixel que ve a esfera editada.
+
+int main() {
+    hittable_list world, lights;
+    world.add(make_shared<sphere>(point3(0, -1000, 0), 1000, make_shared<lambertian>(color(0.5, 0.5, 0.5))));
+
+    std::vector<shared_ptr<sphere>> grid;
+    for (int a = -20; a < 20; a++) {
+        for (int b = -20; b < 20; b++) {
+            point3 center(0.5*a + 0.2*random_double(), 0.2, 0.5*b + 0.2*random_double());
+            shared_ptr<material> m;
+            auto choose = random_double();
+            if (choose < 0.8)
+                m = make_shared<lambertian>(color::random() * color::random());
+            else if (choose < 0.95)
+                m = make_shared<metal>(color::random(0.5, 1), random_double(0, 0.5));
+            else
+                m = make_shared<dielectric>(1.5);
+            grid.push_back(make_shared<sphere>(center, 0.2, m));
+            world.add(grid.back());
+        }
+    }
+    for (int l = 0; l < 8; l++) {
+        point3 center(8*random_double() - 4, 2 + 2*random_double(), 8*random_double() - 4);
+        auto light = make_shared<sphere>(center, 0.2, make_shared<diffuse_light>(color(40, 36, 30)));
+        world.add(light);
+        lights.add(light);
+    }
+
+    environment env;
+    light_set scene_lights{lights, env};
+    qbvh bvh(world);
+    material_table materials(world);
+    camera cam(point3(0, 6, 9), point3(0, 0, 0), vec3(0, 1, 0), 60, 1.5, 0.0, 10);
+
+    const int width = 150, height = 100;
+    incremental_renderer renderer(width, height, 64, 20);
+    renderer.render(cam, bvh, scene_lights, &materials);
+
+    // Each edit gives one sphere of the grid a mirror material.
+    auto mirror = make_shared<metal>(color(0.9, 0.9, 0.9), 0.0);
+    materials.add(mirror);
+    size_t worst = 0, total = 0, direct = 0, missed = 0;
+    int edits = 0;
+    for (size_t n = 0; n < grid.size(); n += 97, edits++) {
+        auto edited = grid[n];
+        edited->mat_ptr = mirror;
+        auto redone = renderer.update(cam, bvh, scene_lights, &materials, {edited.get()}, {});
+        worst = std::max(worst, redone);
+        total += redone;
+
+        // Pixels whose center ray sees the sphere must be among them.
+        for (int j = 0; j < height; j++) {
+            for (int i = 0; i < width; i++) {
+                hit_record rec;
+                auto r = cam.get_ray((i + 0.5) / (width-1), (j + 0.5) / (height-1));
+                if (!bvh.hit(r, 0.001, infinity, rec) || rec.object != edited.get())
+                    continue;
+                direct++;
+                missed += !renderer.rendered_again(i, j);
+            }
+        }
+    }
+
+    const double pixels = width * height;
+    std::cerr << edits << " edits of one sphere among " << grid.size() << ": " << 100 * total / (edits * pixels)
+              << "% of the pixels rendered again on average, " << 100 * worst / pixels << "% at worst (bound 10%)\n"
+              << direct << " pixels saw an edited sphere, " << missed << " of them missed (bound 0)\n";
+    return worst > 0.10 * pixels || missed > 0 || direct == 0 ? 1 : 0;
+}
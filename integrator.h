@@ -0,0 +1,238 @@
+#ifndef INTEGRATOR_H
+#define INTEGRATOR_H
+
+#include "rtweekend.h"
+
+#include "environment.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "material_table.h"
+#include "perf_counters.h"
+#include "photon_map.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+
+inline double power_heuristic(double pdf_a, double pdf_b) {
+    auto a2 = pdf_a*pdf_a;
+    return a2 / (a2 + pdf_b*pdf_b);
+}
+
+
+// Fontes de luz amostradas diretamente: a lista de objetos emissivos e, quando for um
+// mapa HDR, o ambiente. Cada amostra escolhe uma das duas com probabilidade fixa. Com um
+// mapa de fotons, as causticas dessas luzes vem dele.
+struct light_set {
+    const hittable_list& lights;
+    const environment& env;
+    const photon_map* caustics = nullptr;
+
+    bool empty() const { return lights.objects.empty() && !env.importance_sampled(); }
+
+    double environment_probability() const {
+        if (!env.importance_sampled()) return 0.0;
+        return lights.objects.empty() ? 1.0 : 0.5;
+    }
+
+    double pdf_value(const point3& o, const vec3& v) const {
+        auto p_env = environment_probability();
+        auto pdf = (1 - p_env) * lights.pdf_value(o, v);
+        if (p_env > 0)
+            pdf += p_env * env.pdf_value(v);
+        return pdf;
+    }
+};
+
+
+// Objetos e materiais que um caminho usou, como chaves de 32 bits tiradas do endereco
+// (veja incremental.h). Duas chaves iguais para ids diferentes so fazem um pixel a mais
+// ser refeito.
+class id_set {
+    public:
+        // The high half of a multiplicative hash of the address.
+        static uint32_t key(const void* id) {
+            auto h = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(id)) * 0x9e3779b97f4a7c15ull;
+            return static_cast<uint32_t>(h >> 32);
+        }
+
+        void add(const void* id) {
+            keys.push_back(key(id));
+            if (keys.size() >= limit) {
+                compact();
+                limit = std::max(limit, 2 * keys.size());
+            }
+        }
+
+        // Sorts the keys and drops repeats.
+        void compact() {
+            std::sort(keys.begin(), keys.end());
+            keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        }
+
+    public:
+        std::vector<uint32_t> keys;
+
+    private:
+        size_t limit = 256;   // size at which add() compacts
+};
+
+
+// Amostra direta de uma luz a partir de um ponto com lobo lambertiano (next-event
+// estimation), ponderada contra a amostragem do BRDF pela heuristica de potencia.
+// Com `touched`, anota a luz atingida, o seu material e o objeto que faz sombra.
+color sample_lights(
+    const hit_record& rec, const color& albedo, const hittable& world, const light_set& lights,
+    id_set* touched = nullptr
+) {
+    auto from_environment = random_double() < lights.environment_probability();
+    auto direction = from_environment ? lights.env.sample() : lights.lights.random(rec.p);
+    auto cosine = dot(rec.normal, unit_vector(direction));
+    if (cosine <= 0)
+        return color(0,0,0);
+
+    auto light_pdf = lights.pdf_value(rec.p, direction);
+    if (light_pdf <= 0)
+        return color(0,0,0);
+
+    // Whichever emitter is closest along the direction is the one that contributes,
+    // so lights that overlap each other or the environment are weighted consistently.
+    ray shadow(rec.p, direction);
+    hit_record light_rec;
+    color emitted;
+
+    // A tracked shadow ray needs the blocker itself, so it asks for the closest hit.
+    auto blocked = [&](double t_max) {
+        if (!touched)
+            return world.occluded(shadow, 0.001, t_max);
+        hit_record blocker;
+        if (!world.hit(shadow, 0.001, t_max, blocker))
+            return false;
+        touched->add(blocker.object);
+        return true;
+    };
+
+    if (lights.lights.hit(shadow, 0.001, infinity, light_rec)) {
+        if (touched) {
+            touched->add(light_rec.object);
+            touched->add(light_rec.mat_ptr.get());
+        }
+        if (blocked(light_rec.t - 0.001))
+            return color(0,0,0);
+        emitted = light_rec.mat_ptr->emitted(light_rec.u, light_rec.v, light_rec.p);
+    } else {
+        if (!lights.env.importance_sampled() || blocked(infinity))
+            return color(0,0,0);
+        emitted = lights.env.value(direction);
+    }
+
+    auto brdf_pdf = cosine / pi;
+    return albedo * emitted * (brdf_pdf * power_heuristic(light_pdf, brdf_pdf) / light_pdf);
+}
+
+
+// Estado de um caminho entre dois quiques. O integrador recursivo e o wavefront avancam
+// caminhos pelas mesmas funcoes, so muda a ordem em que isso e feito.
+struct path_state {
+    ray r;
+    color throughput;
+    color radiance;
+    double brdf_pdf;  // pdf of the diffuse bounce that produced r, 0 after the camera or a specular bounce
+    int depth;        // bounces left
+    int pixel;
+    bool diffuse;        // the bounce that produced r was diffuse
+    bool after_diffuse;  // some bounce so far was diffuse
+    bool caustic;        // a specular bounce off a photon target after a diffuse one: light found now is in the caustic map
+};
+
+
+inline path_state camera_path(const ray& r, int depth, int pixel = 0) {
+    return path_state{r, color(1,1,1), color(0,0,0), 0.0, depth, pixel, false, false, false};
+}
+
+
+// The path escaped: gather the background.
+inline void shade_miss(path_state& path, const light_set& lights) {
+    if (path.caustic && lights.caustics->covers_environment())
+        return;
+    auto background = lights.env.value(path.r.direction());
+    if (path.brdf_pdf > 0 && lights.env.importance_sampled())
+        background *= power_heuristic(path.brdf_pdf, lights.pdf_value(path.r.origin(), path.r.direction()));
+    path.radiance += path.throughput * background;
+}
+
+
+// Emission, direct lighting and the next bounce at a hit. Returns false when the path ends.
+// Materials compiled into `materials` are dispatched statically, the rest virtually.
+// `touched` collects what the direct light sample used, as in sample_lights.
+inline bool shade_hit(
+    path_state& path, const hit_record& rec, const hittable& world, const light_set& lights,
+    const material_table* materials = nullptr, id_set* touched = nullptr
+) {
+    auto entry = materials ? materials->find(rec.mat_ptr.get()) : nullptr;
+
+    if (!path.caustic || !lights.caustics->covers(rec.object)) {
+        auto emitted = entry ? materials->emitted(*entry, rec) : rec.mat_ptr->emitted(rec.u, rec.v, rec.p);
+        if (path.brdf_pdf > 0)
+            emitted *= power_heuristic(path.brdf_pdf, lights.pdf_value(path.r.origin(), path.r.direction()));
+        path.radiance += path.throughput * emitted;
+    }
+
+    scatter_record srec;
+    auto scattered = entry ? materials->scatter(*entry, path.r, rec, srec)
+                           : rec.mat_ptr->scatter(path.r, rec, srec);
+    if (!scattered)
+        return false;
+
+    if (srec.is_specular || lights.empty()) {
+        path.brdf_pdf = 0;
+    } else {
+        path.radiance += path.throughput * sample_lights(rec, srec.attenuation, world, lights, touched);
+        auto cosine = dot(rec.normal, unit_vector(srec.scattered.direction()));
+        path.brdf_pdf = fmax(cosine, 0.0) / pi;
+    }
+
+    if (lights.caustics) {
+        if (!srec.is_specular)
+            path.radiance += path.throughput * srec.attenuation * lights.caustics->radiance(rec.p, rec.normal);
+        path.caustic = srec.is_specular && path.after_diffuse && lights.caustics->targets(rec.object);
+    }
+    path.after_diffuse = path.after_diffuse || !srec.is_specular;
+
+    path.diffuse = !srec.is_specular;
+    path.throughput = path.throughput * srec.attenuation;
+    path.r = srec.scattered;
+
+    // If we've exceeded the ray bounce limit, no more light is gathered.
+    return --path.depth > 0;
+}
+
+
+color ray_color(
+    const ray& r, const hittable& world, const light_set& lights, int depth,
+    const material_table* materials = nullptr
+) {
+    if (depth <= 0)
+        return color(0,0,0);
+
+    auto path = camera_path(r, depth);
+    perf_phase phase(render_phase::primary_rays);
+    for (int bounce = 0; ; bounce++) {
+        if (bounce == 1)
+            phase.change(render_phase::secondary_bounces);
+        hit_record rec;
+        if (!world.hit(path.r, 0.001, infinity, rec)) {
+            shade_miss(path, lights);
+            break;
+        }
+        if (!shade_hit(path, rec, world, lights, materials))
+            break;
+    }
+
+    return path.radiance;
+}
+
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include "rtweekend.h"
+
+#include "material.h"
+#include "texture.h"
+#include "texture_loader.h"
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <type_traits>
+#include <typeindex>
+#include <unordered_map>
+#include <vector>
+
+
+// Registro de materiais e texturas da cena.
+//
+// get<T>(args...) devolve sempre a mesma instancia para a mesma classe e os mesmos
+// parametros, entao cem esferas de vidro dividem um unico dielectric(1.5). Os parametros
+// sao comparados bit a bit; ponteiros (texturas passadas para um material) por
+// identidade, o que funciona bem quando as texturas tambem vem do registro. Materiais
+// criados a partir de uma cor usam a solid_color do registro para essa cor. Com um
+// texture_loader, as image_texture sao decodificadas por ele, em paralelo. get<texture>
+// com o nome de uma imagem usa o cache .rttc dela quando existe (texture_cache.h) e, se
+// nao, decodifica a imagem como get<image_texture>.
+
+class resource_registry {
+    public:
+        resource_registry(texture_loader* l = nullptr) : loader(l) {}
+
+        template<class T, class... Args>
+        shared_ptr<T> get(const Args&... args) {
+            key k{std::type_index(typeid(T)), {}};
+            append(k.words, args...);
+
+            auto it = cache.find(k);
+            if (it != cache.end())
+                return std::static_pointer_cast<T>(it->second);
+
+            auto object = create<T>(args...);
+            cache.emplace(std::move(k), object);
+            return object;
+        }
+
+        size_t size() const { return cache.size(); }
+
+    private:
+        struct key {
+            std::type_index type;
+            std::vector<uint64_t> words;
+
+            bool operator==(const key& other) const {
+                return type == other.type && words == other.words;
+            }
+        };
+
+        struct key_hash {
+            size_t operator()(const key& k) const {
+                auto h = static_cast<uint64_t>(k.type.hash_code());
+                for (auto w : k.words)
+                    h = (h ^ w) * 1099511628211ull;  // FNV-1a over whole words
+                return static_cast<size_t>(h ^ (h >> 32));
+            }
+        };
+
+        template<class T, class... Args>
+        shared_ptr<T> create(const Args&... args) {
+            if constexpr (sizeof...(Args) == 1
+                    && (std::is_same<Args, color>::value && ...)
+                    && std::is_constructible<T, shared_ptr<texture>>::value
+                    && !std::is_same<T, solid_color>::value) {
+                return make_scene_ptr<T>(shared_ptr<texture>(get<solid_color>(args...)));
+            } else if constexpr (std::is_same<T, image_texture>::value && sizeof...(Args) == 1) {
+                if (loader)
+                    return loader->load(args...);
+                return make_scene_ptr<T>(args...);
+            } else if constexpr (std::is_same<T, texture>::value && sizeof...(Args) == 1) {
+                if (loader)
+                    return loader->load_texture(args...);
+                if (auto cached = open_texture_cache(args...))
+                    return cached;
+                return make_scene_ptr<image_texture>(args...);
+            } else {
+                return make_scene_ptr<T>(args...);
+            }
+        }
+
+        static void append(std::vector<uint64_t>&) {}
+
+        template<class First, class... Rest>
+        static void append(std::vector<uint64_t>& words, const First& first, const Rest&... rest) {
+            append_one(words, first);
+            append(words, rest...);
+        }
+
+        static void append_one(std::vector<uint64_t>& words, double x) {
+            uint64_t bits;
+            std::memcpy(&bits, &x, sizeof(bits));
+            words.push_back(bits);
+        }
+
+        static void append_one(std::vector<uint64_t>& words, int x) {
+            words.push_back(static_cast<uint64_t>(static_cast<int64_t>(x)));
+        }
+
+        static void append_one(std::vector<uint64_t>& words, const vec3& v) {
+            for (int a = 0; a < 3; a++)
+                append_one(words, v[a]);
+        }
+
+        static void append_one(std::vector<uint64_t>& words, const char* s) {
+            // Length first, so no string is a prefix of another.
+            auto length = std::strlen(s);
+            words.push_back(length);
+            for (size_t i = 0; i < length; i += 8) {
+                uint64_t w = 0;
+                std::memcpy(&w, s + i, std::min<size_t>(8, length - i));
+                words.push_back(w);
+            }
+        }
+
+        template<class U>
+        static void append_one(std::vector<uint64_t>& words, const shared_ptr<U>& p) {
+            words.push_back(reinterpret_cast<uintptr_t>(p.get()));
+        }
+
+    private:
+        std::unordered_map<key, shared_ptr<void>, key_hash> cache;
+        texture_loader* loader;
+};
+
+
+#endif
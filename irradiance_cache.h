@@ -0,0 +1,385 @@
+#ifndef IRRADIANCE_CACHE_H
+#define IRRADIANCE_CACHE_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "integrator.h"
+#include "material_table.h"
+#include "memory_stats.h"
+#include "perf_counters.h"
+#include "onb.h"
+#include "sphere_store.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+
+// Cache de irradiancia (Ward).
+//
+// A luz que chega a uma superficie difusa muda devagar de um ponto para outro. Em vez de
+// seguir o caminho inteiro a cada quique difuso depois do primeiro, a radiancia media que
+// chega ao hemisferio (ponderada pelo cosseno) e calculada em alguns pontos esparsos,
+// com os gradientes de rotacao e de translacao, e interpolada entre eles. Cada registro
+// vale num raio proporcional a distancia media ate a geometria em volta; `error` (o `a`
+// de Ward) limita o erro da interpolacao: quanto menor, mais registros e menos erro.
+//
+// Os registros ficam numa grade com hash em varios niveis (cada registro no nivel cujas
+// celulas tem o tamanho do seu raio de validade, em ate 8 celulas). Cada celula e uma
+// lista ligada: a insercao e um compare-and-swap na cabeca, e a leitura nao trava, entao
+// todas as threads consultam e inserem ao mesmo tempo.
+
+class irradiance_cache {
+    public:
+        // The records are computed by tracing strata * pi*strata paths of up to `depth`
+        // bounces, lit by `lights`. Record radii are clamped to [min_spacing, max_spacing].
+        irradiance_cache(
+            const hittable& w, const light_set& l, const material_table* m, double error = 0.2,
+            double min_spacing = 0.05, double max_spacing = 10, int strata = 8, int depth = 8);
+
+        ~irradiance_cache();
+
+        irradiance_cache(const irradiance_cache&) = delete;
+        irradiance_cache& operator=(const irradiance_cache&) = delete;
+
+        // Cosine-weighted mean radiance arriving at p from the hemisphere around n:
+        // interpolated from the records near p, or from a new record at p when none of
+        // them is valid there. Multiplied by a lambertian albedo it is the light the
+        // surface reflects, apart from the direct light found by sampling the lights.
+        color incoming(const point3& p, const vec3& normal);
+
+        size_t size() const { return record_count.load(std::memory_order_relaxed); }
+
+    private:
+        struct record;
+
+        struct link {
+            const record* rec;
+            link* next;
+            long x, y, z;
+            int level;
+        };
+
+        struct record {
+            point3 p;
+            vec3 n;
+            double radius;
+            color value;
+            vec3 rotation[3];      // gradients per color channel
+            vec3 translation[3];
+            link links[8];
+            record* next_allocated;
+        };
+
+        bool interpolate(const point3& p, const vec3& n, color& result) const;
+        record* compute(const point3& p, const vec3& n) const;
+        void insert(record* rec);
+
+        double cell_size(int level) const { return base_cell * (1 << level); }
+
+        uint64_t bucket(long x, long y, long z, int level) const {
+            auto h = splitmix64(static_cast<uint64_t>(x) * 73856093u
+                                ^ static_cast<uint64_t>(y) * 19349663u
+                                ^ static_cast<uint64_t>(z) * 83492791u
+                                ^ static_cast<uint64_t>(level) << 56);
+            return h & (buckets.size() - 1);
+        }
+
+    private:
+        const hittable& world;
+        light_set lights;
+        const material_table* materials;
+        double error;
+        double min_spacing, max_spacing;
+        int theta_strata, phi_strata;
+        int max_depth;
+
+        double base_cell;
+        int levels;
+        std::vector<std::atomic<link*>> buckets;
+        std::atomic<record*> allocated{nullptr};
+        std::atomic<size_t> record_count{0};
+};
+
+
+irradiance_cache::irradiance_cache(
+    const hittable& w, const light_set& l, const material_table* m, double error,
+    double min_spacing, double max_spacing, int strata, int depth
+) : world(w), lights(l), materials(m), error(error), min_spacing(min_spacing),
+    max_spacing(std::max(max_spacing, min_spacing)), theta_strata(std::max(strata, 2)),
+    phi_strata(static_cast<int>(pi * std::max(strata, 2) + 0.5)), max_depth(depth),
+    buckets(1 << 20)
+{
+    // The cells of level 0 fit the smallest records.
+    base_cell = 2 * error * min_spacing;
+    levels = 1;
+    while (cell_size(levels - 1) < 2 * error * max_spacing && levels < 24)
+        levels++;
+    for (auto& head : buckets)
+        head.store(nullptr, std::memory_order_relaxed);
+    memory_add(memory_tag::light_caches, buckets.size() * sizeof(buckets[0]));
+}
+
+
+irradiance_cache::~irradiance_cache() {
+    auto rec = allocated.load();
+    while (rec) {
+        auto next = rec->next_allocated;
+        delete rec;
+        rec = next;
+    }
+    memory_remove(memory_tag::light_caches, buckets.size() * sizeof(buckets[0]) + size() * sizeof(record));
+}
+
+
+color irradiance_cache::incoming(const point3& p, const vec3& normal) {
+    // Not every primitive returns a unit normal.
+    auto n = unit_vector(normal);
+    color result;
+    if (interpolate(p, n, result))
+        return result;
+
+    auto rec = compute(p, n);
+    insert(rec);
+    return rec->value;
+}
+
+
+bool irradiance_cache::interpolate(const point3& p, const vec3& n, color& result) const {
+    double weights = 0;
+    color sum(0, 0, 0);
+
+    for (int level = 0; level < levels; level++) {
+        auto size = cell_size(level);
+        auto x = static_cast<long>(floor(p.x() / size));
+        auto y = static_cast<long>(floor(p.y() / size));
+        auto z = static_cast<long>(floor(p.z() / size));
+
+        for (auto l = buckets[bucket(x, y, z, level)].load(std::memory_order_acquire); l; l = l->next) {
+            if (l->x != x || l->y != y || l->z != z || l->level != level)
+                continue;   // another cell in the same bucket
+            const auto& rec = *l->rec;
+
+            // Ward's error estimate; records with a larger one do not apply here.
+            auto offset = p - rec.p;
+            auto cosine = std::min(dot(n, rec.n), 1.0);
+            auto estimate = offset.length() / rec.radius + sqrt(1 - cosine);
+            if (estimate >= error)
+                continue;
+
+            // Points behind the record's surface see other geometry.
+            if (dot(offset, n + rec.n) < -0.1 * rec.radius)
+                continue;
+
+            auto w = 1 / std::max(estimate, 1e-6) - 1 / error;
+            auto axis = cross(rec.n, n);
+            color value;
+            for (int c = 0; c < 3; c++)
+                value[c] = rec.value[c] + dot(axis, rec.rotation[c]) + dot(offset, rec.translation[c]);
+            sum += w * color(fmax(value.x(), 0.0), fmax(value.y(), 0.0), fmax(value.z(), 0.0));
+            weights += w;
+        }
+    }
+
+    if (weights <= 0)
+        return false;
+    result = sum / weights;
+    return true;
+}
+
+
+irradiance_cache::record* irradiance_cache::compute(const point3& p, const vec3& n) const {
+    // The hemisphere paths of a record are indirect light, whatever bounce asked for it.
+    perf_phase phase(render_phase::secondary_bounces);
+
+    // Stratified cosine-weighted directions: theta rows j, phi columns k.
+    auto M = theta_strata, N = phi_strata;
+    std::vector<color> radiance(static_cast<size_t>(M) * N);
+    std::vector<double> distance(static_cast<size_t>(M) * N);
+    std::vector<double> sin_theta(static_cast<size_t>(M) * N);
+    std::vector<double> phi(static_cast<size_t>(M) * N);
+
+    onb uvw;
+    uvw.build_from_w(n);
+
+    // The paths are traced as if they had just left a diffuse bounce, so light reached
+    // through a caustic is skipped like it is for a regular path.
+    double inverse_distances = 0;
+    for (int j = 0; j < M; j++) {
+        for (int k = 0; k < N; k++) {
+            auto i = static_cast<size_t>(j) * N + k;
+            sin_theta[i] = sqrt((j + random_double()) / M);
+            phi[i] = 2*pi * (k + random_double()) / N;
+            auto cos_theta = sqrt(1 - sin_theta[i]*sin_theta[i]);
+            auto direction = uvw.local(cos(phi[i]) * sin_theta[i], sin(phi[i]) * sin_theta[i], cos_theta);
+
+            auto path = camera_path(ray(p, direction), max_depth);
+            path.brdf_pdf = cos_theta / pi;
+            path.diffuse = path.after_diffuse = true;
+
+            distance[i] = infinity;
+            bool first = true;
+            while (true) {
+                hit_record rec;
+                if (!world.hit(path.r, 0.001, infinity, rec)) {
+                    shade_miss(path, lights);
+                    break;
+                }
+                if (first)
+                    distance[i] = rec.t * path.r.direction().length();
+                first = false;
+                if (!shade_hit(path, rec, world, lights, materials))
+                    break;
+
+                // Records already there stand in for the rest of the path, as in Ward's
+                // recursion, but no new record is made from inside another one.
+                color cached;
+                if (path.diffuse && interpolate(rec.p, unit_vector(rec.normal), cached)) {
+                    path.radiance += path.throughput * cached;
+                    break;
+                }
+            }
+
+            radiance[i] = path.radiance;
+            inverse_distances += 1 / distance[i];
+        }
+    }
+
+    auto rec = new record;
+    rec->p = p;
+    rec->n = n;
+    rec->value = color(0, 0, 0);
+    for (const auto& l : radiance)
+        rec->value += l;
+    rec->value /= M * N;
+
+    // Gradients after Ward and Heckbert, for cosine-weighted strata, in the units of the
+    // mean radiance (irradiance / pi).
+    vec3 rotation[3] = {vec3(0,0,0), vec3(0,0,0), vec3(0,0,0)};
+    vec3 translation[3] = {vec3(0,0,0), vec3(0,0,0), vec3(0,0,0)};
+    for (int k = 0; k < N; k++) {
+        auto k_previous = (k + N - 1) % N;
+        auto phi_boundary = 2*pi * k / N;
+        auto across = uvw.local(-sin(phi_boundary), cos(phi_boundary), 0);   // normal of the boundary before column k
+
+        for (int j = 0; j < M; j++) {
+            auto i = static_cast<size_t>(j) * N + k;
+            auto tan_theta = sin_theta[i] / sqrt(std::max(1 - sin_theta[i]*sin_theta[i], 1e-12));
+            auto turn = uvw.local(-sin(phi[i]), cos(phi[i]), 0);
+            for (int c = 0; c < 3; c++)
+                rotation[c] += (-tan_theta * radiance[i][c] / (M * N)) * turn;
+
+            // Change across the boundary with the previous column...
+            auto sin_low = sqrt(double(j) / M), sin_high = sqrt(double(j + 1) / M);
+            auto cos_low = sqrt(1 - sin_low*sin_low);
+            auto previous = static_cast<size_t>(j) * N + k_previous;
+            auto reach = std::min(distance[i], distance[previous]);
+            if (reach < infinity)
+                for (int c = 0; c < 3; c++)
+                    translation[c] += ((sin_high - sin_low) / reach
+                                       * (radiance[i][c] - radiance[previous][c]) / pi) * across;
+
+            // ...and with the previous row.
+            if (j > 0) {
+                auto phi_center = 2*pi * (k + 0.5) / N;
+                auto out = uvw.local(cos(phi_center), sin(phi_center), 0);
+                auto below = static_cast<size_t>(j - 1) * N + k;
+                auto reach_row = std::min(distance[i], distance[below]);
+                if (reach_row < infinity)
+                    for (int c = 0; c < 3; c++)
+                        translation[c] += ((2*pi / N) * sin_low * cos_low * cos_low / reach_row
+                                           * (radiance[i][c] - radiance[below][c]) / pi) * out;
+            }
+        }
+    }
+
+    // Harmonic mean distance, shortened where the light changes fast.
+    auto radius = inverse_distances > 0 ? M * N / inverse_distances : max_spacing;
+    for (int c = 0; c < 3; c++) {
+        rec->rotation[c] = rotation[c];
+        rec->translation[c] = translation[c];
+        auto slope = translation[c].length();
+        if (slope > 0 && rec->value[c] > 0)
+            radius = std::min(radius, rec->value[c] / slope);
+    }
+    rec->radius = clamp(radius, min_spacing, max_spacing);
+
+    // Where the clamp made the record reach further than its gradient allows, the
+    // gradient is scaled down so it cannot overshoot by more than the value itself.
+    for (int c = 0; c < 3; c++) {
+        auto change = rec->translation[c].length() * rec->radius;
+        if (change > rec->value[c])
+            rec->translation[c] *= change > 0 ? rec->value[c] / change : 0.0;
+    }
+    return rec;
+}
+
+
+void irradiance_cache::insert(record* rec) {
+    auto reach = error * rec->radius;
+    int level = 0;
+    while (level < levels - 1 && cell_size(level) < 2 * reach)
+        level++;
+    auto size = cell_size(level);
+
+    // Every cell the sphere of validity touches: at most two per axis.
+    long low[3], high[3];
+    for (int a = 0; a < 3; a++) {
+        low[a] = static_cast<long>(floor((rec->p[a] - reach) / size));
+        high[a] = std::min(static_cast<long>(floor((rec->p[a] + reach) / size)), low[a] + 1);
+    }
+
+    int count = 0;
+    for (auto x = low[0]; x <= high[0]; x++)
+        for (auto y = low[1]; y <= high[1]; y++)
+            for (auto z = low[2]; z <= high[2]; z++)
+                rec->links[count++] = {rec, nullptr, x, y, z, level};
+
+    for (int i = 0; i < count; i++) {
+        auto& l = rec->links[i];
+        auto& head = buckets[bucket(l.x, l.y, l.z, level)];
+        l.next = head.load(std::memory_order_acquire);
+        while (!head.compare_exchange_weak(l.next, &l, std::memory_order_acq_rel, std::memory_order_acquire)) {}
+    }
+
+    rec->next_allocated = allocated.load(std::memory_order_relaxed);
+    while (!allocated.compare_exchange_weak(rec->next_allocated, rec, std::memory_order_relaxed)) {}
+    record_count.fetch_add(1, std::memory_order_relaxed);
+    memory_add(memory_tag::light_caches, sizeof(record));
+}
+
+
+// ray_color with the diffuse bounces after the first one read from the cache.
+color ray_color_cached(
+    const ray& r, const hittable& world, const light_set& lights, int depth,
+    const material_table* materials, irradiance_cache& cache
+) {
+    if (depth <= 0)
+        return color(0,0,0);
+
+    auto path = camera_path(r, depth);
+    perf_phase phase(render_phase::primary_rays);
+    for (int bounce = 0; ; bounce++) {
+        if (bounce == 1)
+            phase.change(render_phase::secondary_bounces);
+        hit_record rec;
+        if (!world.hit(path.r, 0.001, infinity, rec)) {
+            shade_miss(path, lights);
+            break;
+        }
+        auto secondary = path.after_diffuse;
+        if (!shade_hit(path, rec, world, lights, materials))
+            break;
+        if (secondary && path.diffuse) {
+            path.radiance += path.throughput * cache.incoming(rec.p, rec.normal);
+            break;
+        }
+    }
+
+    return path.radiance;
+}
+
+
+#endif
@@ -10,35 +10,28 @@
 #include "material.h"
 #include "cylinder.h"
 #include "texture.h"
+#include "qbvh.h"
+#include "environment.h"
+#include "integrator.h"
+#include "wavefront.h"
+#include "intern.h"
+#include "sphere_store.h"
+#include "image_stream.h"
+#include "tile_profiler.h"
+#include "progressive.h"
+#include "render_server.h"
+#include "batch.h"
+#include "incremental.h"
+#include "irradiance_cache.h"
+#include "renderer.h"
+#include "memory_stats.h"
+#include "ray_query.h"
+#include "perf_counters.h"
 
 #include <iostream>
 #include <fstream>  // para ler e gravar em arquivos.
 
 
-// Função auxiliar para criar um fundo de imagem colorido
-// pega a direcao do raio e calcula uma interpolacao entra banco e azul
-color ray_color(const ray& r, const hittable& world, int depth) {
-    hit_record rec;
-
-    // If we've exceeded the ray bounce limit, no more light is gathered.
-    if (depth <= 0)
-        return color(0,0,0);
-
-    if (world.hit(r, 0.001, infinity, rec)) {
-        ray scattered;
-        color attenuation;
-        if (rec.mat_ptr->scatter(r, rec, attenuation, scattered))
-            return attenuation * ray_color(scattered, world, depth-1);
-        return color(0,0,0);
-    }
-
-    vec3 unit_direction = unit_vector(r.direction());
-    auto t = 0.5*(unit_direction.y() + 1.0);
-    return (1.0-t)*color(1.0, 1.0, 1.0) + t*color(0.5, 0.7, 1.0);
-}
-
-
-
 double hit_sphere(const point3& center, double radius, const ray& r) {
    vec3 oc = r.origin() - center;
    auto a = r.direction().length_squared();
@@ -54,10 +47,14 @@ double hit_sphere(const point3& center, double radius, const ray& r) {
 }
 
 hittable_list random_scene() {
+    scene_arena arena;
+    scene_arena::scope use(arena);
+    resource_registry registry;
+
     hittable_list world;
 
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 1000, ground_material));
+    auto ground_material = registry.get<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_scene_ptr<sphere>(point3(0,-1000,0), 1000, ground_material));
 
     for (int a = -11; a < 11; a++) {
         for (int b = -11; b < 11; b++) {
@@ -70,125 +67,209 @@ hittable_list random_scene() {
                 if (choose_mat < 0.8) {
                     // diffuse
                     auto albedo = color::random() * color::random();
-                    sphere_material = make_shared<lambertian>(albedo);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = registry.get<lambertian>(albedo);
+                    world.add(make_scene_ptr<sphere>(center, 0.2, sphere_material));
                 } else if (choose_mat < 0.95) {
                     // metal
                     auto albedo = color::random(0.5, 1);
                     auto fuzz = random_double(0, 0.5);
-                    sphere_material = make_shared<metal>(albedo, fuzz);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = registry.get<metal>(albedo, fuzz);
+                    world.add(make_scene_ptr<sphere>(center, 0.2, sphere_material));
                 } else {
                     // glass
-                    sphere_material = make_shared<dielectric>(1.5);
-                    world.add(make_shared<sphere>(center, 0.2, sphere_material));
+                    sphere_material = registry.get<dielectric>(1.5);
+                    world.add(make_scene_ptr<sphere>(center, 0.2, sphere_material));
                 }
             }
         }
 
         shared_ptr<material> sphere_material;
         auto albedo = color::random() * color::random();
-        sphere_material = make_shared<lambertian>(albedo);
+        sphere_material = registry.get<lambertian>(albedo);
 
-        world.add(make_shared<paraboloid>(point3(1, 0, 0), 2.0, 2.0, 3.0, sphere_material));
+        world.add(make_scene_ptr<paraboloid>(point3(1, 0, 0), 2.0, 2.0, 3.0, sphere_material));
     }
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(0, 1, 0), 1.0, material1));
+    auto material1 = registry.get<dielectric>(1.5);
+    world.add(make_scene_ptr<sphere>(point3(0, 1, 0), 1.0, material1));
+
+    auto material2 = registry.get<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(make_scene_ptr<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = registry.get<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_scene_ptr<sphere>(point3(4, 1, 0), 1.0, material3));
+
+    return world;
+}
+
+// random_scene com cerca de `count` esferas pequenas guardadas numa sphere_store.
+hittable_list massive_random_scene(size_t count, uint64_t seed) {
+    scene_arena arena;
+    scene_arena::scope use(arena);
+    resource_registry registry;
 
-    auto material2 = make_shared<lambertian>(color(0.4, 0.2, 0.1));
-    world.add(make_shared<sphere>(point3(-4, 1, 0), 1.0, material2));
+    hittable_list world;
+
+    auto ground_material = registry.get<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_scene_ptr<sphere>(point3(0,-1000,0), 1000, ground_material));
+
+    // Room is left for the three large spheres, as in random_scene.
+    auto store = make_shared<sphere_store>();
+    generate_spheres(*store, count, seed, registry,
+                     {{point3(0, 1, 0), 1.0}, {point3(-4, 1, 0), 1.0}, {point3(4, 1, 0), 1.0}});
+    world.add(store);
+
+    auto material1 = registry.get<dielectric>(1.5);
+    world.add(make_scene_ptr<sphere>(point3(0, 1, 0), 1.0, material1));
 
-    auto material3 = make_shared<metal>(color(0.7, 0.6, 0.5), 0.0);
-    world.add(make_shared<sphere>(point3(4, 1, 0), 1.0, material3));
+    auto material2 = registry.get<lambertian>(color(0.4, 0.2, 0.1));
+    world.add(make_scene_ptr<sphere>(point3(-4, 1, 0), 1.0, material2));
+
+    auto material3 = registry.get<metal>(color(0.7, 0.6, 0.5), 0.0);
+    world.add(make_scene_ptr<sphere>(point3(4, 1, 0), 1.0, material3));
 
     return world;
 }
 
 hittable_list earth() {
-    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    auto globe = make_shared<sphere>(point3(0,0,0), 2, earth_surface);
+    scene_arena arena;
+    scene_arena::scope use(arena);
+    resource_registry registry(&default_texture_loader());
+
+    auto earth_texture = registry.get<texture>("earthmap.jpg");
+    auto earth_surface = registry.get<lambertian>(earth_texture);
+    auto globe = make_scene_ptr<sphere>(point3(0,0,0), 2, earth_surface);
     return hittable_list(globe);
 }
 
 hittable_list earth_cylider() {
-    auto earth_texture = make_shared<image_texture>("earthmap.jpg");
-    auto earth_surface = make_shared<lambertian>(earth_texture);
-    auto globe = make_shared<cylinder>(point3(0,0,0), 1.5, 4, earth_surface);
+    scene_arena arena;
+    scene_arena::scope use(arena);
+    resource_registry registry(&default_texture_loader());
+
+    auto earth_texture = registry.get<texture>("earthmap.jpg");
+    auto earth_surface = registry.get<lambertian>(earth_texture);
+    auto globe = make_scene_ptr<cylinder>(point3(0,0,0), 1.5, 4, earth_surface);
     return hittable_list(globe);
 }
 
 hittable_list two_perlin_spheres() {
+    scene_arena arena;
+    scene_arena::scope use(arena);
+    resource_registry registry;
+
     hittable_list objects;
 
-    auto pertext = make_shared<noise_texture>();
+    auto pertext = registry.get<noise_texture>();
 
-    auto metal_material = make_shared<metal>(color(0.8, 0.1, 0.3), 0.0);
-    objects.add(make_shared<sphere>(point3(0,-1000,0), 1000, make_shared<lambertian>(pertext)));
-    objects.add(make_shared<sphere>(point3(0, 2, 0), 2, metal_material));
+    auto metal_material = registry.get<metal>(color(0.8, 0.1, 0.3), 0.0);
+    objects.add(make_scene_ptr<sphere>(point3(0,-1000,0), 1000, registry.get<lambertian>(pertext)));
+    objects.add(make_scene_ptr<sphere>(point3(0, 2, 0), 2, metal_material));
 
     return objects;
 }
 
 hittable_list marble_spheres() {
+    scene_arena arena;
+    scene_arena::scope use(arena);
+    resource_registry registry;
+
     // World Objects
     hittable_list objects;
 
     // Textures
-    auto pertext = make_shared<noise_texture>();
-    auto pertext2 = make_shared<noise_texture2>(0.5, color(0.9, 0.8, 0.9));
-    auto pertext3 = make_shared<noise_texture2>(0.5, color(0.8, 0.9, 0.8));
+    auto pertext = registry.get<noise_texture>();
+    auto pertext2 = registry.get<noise_texture2>(0.5, color(0.9, 0.8, 0.9));
+    auto pertext3 = registry.get<noise_texture2>(0.5, color(0.8, 0.9, 0.8));
 
     // Defined Materials
     // auto marble_material = make_shared<marble>(0.0);
-    auto lambertian_material = make_shared<lambertian>(color(0.9, 0.9, 0.9));
-    auto glass_material = make_shared<dielectric>(1.5);
-    auto metal_material = make_shared<metal>(color(0.7, 0.8, 0.7), 0.0);
+    auto lambertian_material = registry.get<lambertian>(color(0.9, 0.9, 0.9));
+    auto glass_material = registry.get<dielectric>(1.5);
+    auto metal_material = registry.get<metal>(color(0.7, 0.8, 0.7), 0.0);
 
     // Ground
-    objects.add(make_shared<sphere>(point3(0,-1000,0), 999, lambertian_material));
+    objects.add(make_scene_ptr<sphere>(point3(0,-1000,0), 999, lambertian_material));
 
     // Objects
 
     // Marbles
-    objects.add(make_shared<sphere>(point3(0, 0, 0), 1, make_shared<marble>(pertext2)));
-    objects.add(make_shared<sphere>(point3(-4, 0, 2), 1, make_shared<marble>(pertext)));
-    objects.add(make_shared<sphere>(point3(-2, 0, -2), 1, make_shared<marble>(pertext3)));
+    objects.add(make_scene_ptr<sphere>(point3(0, 0, 0), 1, registry.get<marble>(pertext2)));
+    objects.add(make_scene_ptr<sphere>(point3(-4, 0, 2), 1, registry.get<marble>(pertext)));
+    objects.add(make_scene_ptr<sphere>(point3(-2, 0, -2), 1, registry.get<marble>(pertext3)));
 
     // Glass
-    objects.add(make_shared<sphere>(point3(-8, 0, -5), 2, glass_material));
+    objects.add(make_scene_ptr<sphere>(point3(-8, 0, -5), 2, glass_material));
 
     // Metal
-    objects.add(make_shared<sphere>(point3(-70, 0, -8), 5, metal_material));
+    objects.add(make_scene_ptr<sphere>(point3(-70, 0, -8), 5, metal_material));
+
+    return objects;
+}
+
+hittable_list small_lights(hittable_list& lights) {
+    scene_arena arena;
+    scene_arena::scope use(arena);
+    resource_registry registry;
+
+    // Marmores iluminados por duas luzes pequenas
+    auto objects = marble_spheres();
+
+    auto warm = registry.get<diffuse_light>(color(40, 32, 24));
+    auto cool = registry.get<diffuse_light>(color(12, 16, 24));
+
+    auto light1 = make_scene_ptr<sphere>(point3(2, 4, 2), 0.3, warm);
+    auto light2 = make_scene_ptr<sphere>(point3(-3, 5, -4), 0.5, cool);
+
+    objects.add(light1);
+    objects.add(light2);
+    lights.add(light1);
+    lights.add(light2);
 
     return objects;
 }
 
 hittable_list paraboloid_plot() {
+    scene_arena arena;
+    scene_arena::scope use(arena);
+    resource_registry registry;
+
     hittable_list world;
 
-    auto ground_material = make_shared<lambertian>(color(0.5, 0.5, 0.5));
-    world.add(make_shared<sphere>(point3(0,-1000,0), 998, ground_material));
+    auto ground_material = registry.get<lambertian>(color(0.5, 0.5, 0.5));
+    world.add(make_scene_ptr<sphere>(point3(0,-1000,0), 998, ground_material));
 
-    auto metal_material = make_shared<metal>(color(0.8, 0.1, 0.3), 0.0);
+    auto metal_material = registry.get<metal>(color(0.8, 0.1, 0.3), 0.0);
 
     shared_ptr<material> diffuse_material;
     auto albedo = color::random() * color::random();
-    diffuse_material = make_shared<lambertian>(albedo);
+    diffuse_material = registry.get<lambertian>(albedo);
     
-    world.add(make_shared<paraboloid>(point3(0, 0, 0), 0.5, 0.5, 4.0, diffuse_material));
-    // world.add(make_shared<paraboloid>(point3(1, 1, 1), 3.0, 1.0, diffuse_material));
+    world.add(make_scene_ptr<paraboloid>(point3(0, 0, 0), 0.5, 0.5, 4.0, diffuse_material));
+    // world.add(make_scene_ptr<paraboloid>(point3(1, 1, 1), 3.0, 1.0, diffuse_material));
 
-    auto material1 = make_shared<dielectric>(1.5);
-    world.add(make_shared<sphere>(point3(-7, 1, -1), 1.0, material1));
+    auto material1 = registry.get<dielectric>(1.5);
+    world.add(make_scene_ptr<sphere>(point3(-7, 1, -1), 1.0, material1));
 
-    world.add(make_shared<sphere>(point3(-1, 1, -5), 2.0, metal_material));
+    world.add(make_scene_ptr<sphere>(point3(-1, 1, -5), 2.0, metal_material));
 
-    world.add(make_shared<sphere>(point3(0, 0, 0), 1.0, material1));
+    world.add(make_scene_ptr<sphere>(point3(0, 0, 0), 1.0, material1));
 }
 
-int main() {
+int main(int argc, char** argv) {
+
+    // Servidor: main --serve /tmp/raytracing.sock
+    if (argc == 3 && std::string(argv[1]) == "--serve") {
+        render_server server;
+        server.add_scene("random", [](hittable_list&) { return random_scene(); });
+        server.add_scene("earth", [](hittable_list&) { return earth(); });
+        server.add_scene("earth_cylinder", [](hittable_list&) { return earth_cylider(); });
+        server.add_scene("perlin", [](hittable_list&) { return two_perlin_spheres(); });
+        server.add_scene("marble", [](hittable_list&) { return marble_spheres(); });
+        server.add_scene("small_lights", [](hittable_list& lights) { return small_lights(lights); });
+        server.add_scene("massive", [](hittable_list&) { return massive_random_scene(1000000, 1); });
+        return server.serve(argv[2]) ? 0 : 1;
+    }
 
     // Image
 
@@ -197,12 +278,51 @@ int main() {
     const int image_height = static_cast<int>(image_width / aspect_ratio);
     const int samples_per_pixel = 100;
     const int max_depth = 50;
+    const bool wavefront = false;  // avanca uma linha inteira de caminhos por vez, agrupados por material
+    const bool streaming = false;  // grava faixas de tiles direto no arquivo, para imagens enormes
+    const int tile_size = 64;
+    const double time_budget = 0;  // segundos; > 0 refina a imagem em passadas adaptativas ate o prazo
+    const int batch_frames = 0;    // > 0 renderiza uma volta da camera em torno da cena (frame_0000.ppm, ...)
+    const bool incremental = false;  // troca o material de uma esfera e refaz so os pixels que ela afeta
+    const int caustic_photons = 0;   // > 0 traca fotons pelo vidro e metal antes de renderizar (causticas)
+    const double irradiance_error = 0;  // > 0 interpola a luz indireta difusa de um cache (o `a` de Ward, p. ex. 0.3)
+    const bool embedded = false;  // renderiza pela API assincrona (renderer.h), acompanhando o progresso
+    const size_t massive_spheres = 0;  // > 0 troca a cena por massive_random_scene com tantas esferas compactas
+    const bool hardware_counters = false;  // ciclos, instrucoes e misses de cache e de desvio por fase (Linux)
+
+    if (hardware_counters)
+        perf_counters::enable();
 
     // World
 
     hittable_list world;
+    hittable_list lights;
+    environment env;
+
+    perf_phase build(render_phase::scene_build);
+    world = massive_spheres > 0 ? massive_random_scene(massive_spheres, 1) : marble_spheres();
+    default_texture_loader().wait();  // texturas decodificadas em paralelo durante a montagem
+
+    qbvh bvh(world);
+    material_table materials(world);
+    build.finish();
+    light_set scene_lights{lights, env};
+
+    photon_map caustics;
+    if (caustic_photons > 0) {
+        caustics.build(world, bvh, lights, env, &materials, caustic_photons, 0.05);
+        scene_lights.caustics = &caustics;
+        std::cerr << caustics.size() << " caustic photons.\n";
+    }
 
-    world = marble_spheres();
+    std::unique_ptr<irradiance_cache> indirect;
+    if (irradiance_error > 0)
+        indirect.reset(new irradiance_cache(bvh, scene_lights, &materials, irradiance_error));
+    auto radiance = [&](const ray& r) {
+        if (indirect)
+            return ray_color_cached(r, bvh, scene_lights, max_depth, &materials, *indirect);
+        return ray_color(r, bvh, scene_lights, max_depth, &materials);
+    };
 
     // Camera
 
@@ -215,25 +335,154 @@ int main() {
     camera cam(lookfrom, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus);
 
     // Render
-    std::ofstream file;  // Cria um stream para arquivos
-    file.open("image.ppm");  // Abre um arquivo para saída do stream
+    if (embedded) {
+        auto scene = std::make_shared<render_scene>();
+        scene->world = world;
+        scene->lights = lights;
+
+        render_settings settings;
+        settings.image_width = image_width;
+        settings.image_height = image_height;
+        settings.samples_per_pixel = samples_per_pixel;
+        settings.max_depth = max_depth;
+
+        renderer engine;
+        auto job = engine.render(scene, cam, settings);
+        while (job->result().wait_for(std::chrono::milliseconds(500)) != std::future_status::ready)
+            std::cerr << "\rProgress: " << static_cast<int>(100 * job->progress()) << "% " << std::flush;
+
+        std::ofstream file("image.ppm");
+        job->write(file);
+        std::cerr << "\nDone.\n";
+        write_memory_report(std::cerr);
+        perf_counters::write_report(std::cerr);
+        return 0;
+    }
 
-    file << "P3\n" << image_width << ' ' << image_height << "\n255\n";
-    for (int j = image_height-1; j >= 0; --j) {
-        std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
-        for (int i = 0; i < image_width; ++i) {
+    if (batch_frames > 0) {
+        // A camera gira em torno de lookat, na mesma altura e distancia.
+        std::vector<camera> cameras;
+        auto arm = lookfrom - lookat;
+        auto radius = sqrt(arm.x()*arm.x() + arm.z()*arm.z());
+        auto step = 2*pi / std::max(batch_frames, 1);
+        for (int f = 0; f < batch_frames; f++) {
+            auto angle = atan2(arm.z(), arm.x()) + step*f;
+            point3 from = lookat + vec3(radius*cos(angle), arm.y(), radius*sin(angle));
+            cameras.emplace_back(from, lookat, vup, 20, aspect_ratio, aperture, dist_to_focus);
+        }
+
+        batch_renderer batch(bvh, scene_lights, &materials, image_width, image_height,
+                             samples_per_pixel, max_depth);
+        batch.render_cameras(cameras, "frame_%04d.ppm");
+        std::cerr << "Done.\n";
+        write_memory_report(std::cerr);
+        perf_counters::write_report(std::cerr);
+        return 0;
+    }
+
+    if (incremental) {
+        incremental_renderer renderer(image_width, image_height, samples_per_pixel, max_depth);
+        renderer.render(cam, bvh, scene_lights, &materials);
+
+        // A esfera do centro (a segunda de marble_spheres) vira metal.
+        auto& edited = static_cast<sphere&>(*world.objects[1]);
+        auto old_material = edited.mat_ptr;
+        edited.mat_ptr = make_shared<metal>(color(0.8, 0.6, 0.2), 0.1);
+
+        auto redone = renderer.update(cam, bvh, scene_lights, &materials,
+                                      {&edited, old_material.get()}, {});
+        std::ofstream file("image.ppm");
+        renderer.write(file);
+        std::cerr << redone << " of " << image_width * image_height
+                  << " pixels rendered again.\nDone.\n";
+        write_memory_report(std::cerr);
+        perf_counters::write_report(std::cerr);
+        return 0;
+    }
+
+    if (time_budget > 0) {
+        progressive_renderer progressive(image_width, image_height);
+        progressive.render(time_budget, [&](int i, int j) {
+            auto u = (i + random_double()) / (image_width-1);
+            auto v = (j + random_double()) / (image_height-1);
+            return radiance(cam.get_ray(u, v));
+        });
+
+        std::ofstream file("image.ppm");
+        progressive.write(file);
+        std::cerr << progressive.passes() << " passes, "
+                  << progressive.total_samples() / double(image_width * image_height)
+                  << " samples per pixel.\nDone.\n";
+        write_memory_report(std::cerr);
+        perf_counters::write_report(std::cerr);
+        return 0;
+    }
+
+    if (streaming) {
+        image_stream out("image.pfm", image_format::pfm, image_width, image_height, samples_per_pixel);
+        tile_profiler profiler(image_width, image_height, tile_size);
+        render_streaming(out, image_width, image_height, tile_size, [&](int i, int j) {
             color pixel_color(0, 0, 0);
             for (int s = 0; s < samples_per_pixel; ++s) {
                 auto u = (i + random_double()) / (image_width-1);
                 auto v = (j + random_double()) / (image_height-1);
                 ray r = cam.get_ray(u, v);
-                pixel_color += ray_color(r, world, max_depth);
+                pixel_color += radiance(r);
+            }
+            return pixel_color;
+        }, &profiler);
+        profiler.write_heatmap("image_heatmap.ppm");  // custo por tile
+        profiler.write_trace("image_trace.json");     // abrir em chrome://tracing
+        std::cerr << "\nDone.\n";
+        write_memory_report(std::cerr);
+        perf_counters::write_report(std::cerr);
+        return 0;
+    }
+
+    std::ofstream file;  // Cria um stream para arquivos
+    file.open("image.ppm");  // Abre um arquivo para saída do stream
 
+    file << "P3\n" << image_width << ' ' << image_height << "\n255\n";
+
+    if (wavefront) {
+        wavefront_integrator integrator(bvh, scene_lights, &materials);
+        std::vector<path_state> paths;
+        std::vector<color> film;
+
+        for (int j = image_height-1; j >= 0; --j) {
+            std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
+            paths.clear();
+            film.assign(image_width, color(0, 0, 0));
+            for (int i = 0; i < image_width; ++i) {
+                for (int s = 0; s < samples_per_pixel; ++s) {
+                    auto u = (i + random_double()) / (image_width-1);
+                    auto v = (j + random_double()) / (image_height-1);
+                    paths.push_back(camera_path(cam.get_ray(u, v), max_depth, i));
+                }
+            }
+            integrator.trace(paths, film);
+            for (int i = 0; i < image_width; ++i)
+                write_color(file, film[i], samples_per_pixel);
+        }
+    } else {
+        for (int j = image_height-1; j >= 0; --j) {
+            std::cerr << "\rScanlines remaining: " << j << ' ' << std::flush;
+            for (int i = 0; i < image_width; ++i) {
+                color pixel_color(0, 0, 0);
+                for (int s = 0; s < samples_per_pixel; ++s) {
+                    auto u = (i + random_double()) / (image_width-1);
+                    auto v = (j + random_double()) / (image_height-1);
+                    ray r = cam.get_ray(u, v);
+                    pixel_color += radiance(r);
+
+                }
+                write_color(file, pixel_color, samples_per_pixel);
             }
-            write_color(file, pixel_color, samples_per_pixel);
         }
     }
 
     file.close();  // Fecha o stream para arquivo
     std::cerr << "\nDone.\n";
+    write_memory_report(std::cerr);  // bytes por subsistema, atuais e de pico
+    perf_counters::write_report(std::cerr);
 }
@@ -0,0 +1,27 @@
+#include "rtweekend.h"
+
+#include "texture_cache.h"
+
+#include <iostream>
+
+
+// Converte imagens para o cache de texturas usado por cached_texture.
+//
+//     make_texture_cache earthmap.jpg earthmap.rttc [outra.png outra.rttc ...]
+
+int main(int argc, char** argv) {
+    if (argc < 3 || argc % 2 != 1) {
+        std::cerr << "usage: " << argv[0] << " image cache [image cache ...]\n";
+        return 1;
+    }
+
+    int failed = 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        if (write_texture_cache(argv[i], argv[i+1]))
+            std::cerr << argv[i] << " -> " << argv[i+1] << '\n';
+        else
+            failed++;
+    }
+
+    return failed ? 1 : 0;
+}
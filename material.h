@@ -2,33 +2,78 @@
 #define MATERIAL_H
 
 #include "rtweekend.h"
+
+#include "fast_math.h"
+#include "perf_counters.h"
 #include "texture.h"
 
+#include <atomic>
+#include <cstdint>
+
 struct hit_record;
 
+// Resultado de scatter(). Amostras nao especulares sao sempre tiradas com distribuicao
+// de cosseno de um lobo lambertiano com albedo `attenuation`, o que permite combina-las
+// com amostragem direta das luzes (MIS). Lobos especulares ou glossy nao participam.
+struct scatter_record {
+    ray scattered;
+    color attenuation;
+    bool is_specular;
+};
+
 class material {
    public:
        virtual bool scatter(
-           const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+           const ray& r_in, const hit_record& rec, scatter_record& srec
        ) const = 0;
+
+       virtual color emitted(double u, double v, const point3& p) const {
+           return color(0,0,0);
+       }
+
+       material() : id(next_id()) {}
+       material(const material&) : id(next_id()) {}   // a copy is another material
+       material& operator=(const material&) { return *this; }
+
+   public:
+       // Number of this material, never reused while the program runs. Materials made
+       // together get consecutive ids, so material_table can index its slots by them.
+       const uint32_t id;
+
+   private:
+       static uint32_t next_id() {
+           static std::atomic<uint32_t> next{0};
+           return next.fetch_add(1, std::memory_order_relaxed);
+       }
 };
 
 class lambertian : public material {
     public:
-        lambertian(const color& a) : albedo(make_shared<solid_color>(a)) {}
+        lambertian(const color& a) : albedo(make_scene_ptr<solid_color>(a)) {}
         lambertian(shared_ptr<texture> a) : albedo(a) {}
 
         virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+            const ray& r_in, const hit_record& rec, scatter_record& srec
         ) const override {
+            color albedo_color;
+            {
+                perf_phase phase(render_phase::texture_lookup);
+                albedo_color = albedo->value(rec.u, rec.v, rec.p);
+            }
+            return scatter_with(albedo_color, rec, srec);
+        }
+
+        // Scatter kernel with the albedo already looked up, shared with material_table.
+        static bool scatter_with(const color& albedo, const hit_record& rec, scatter_record& srec) {
             auto scatter_direction = rec.normal + random_unit_vector();
 
             // Catch degenerate scatter direction
             if (scatter_direction.near_zero())
                 scatter_direction = rec.normal;
 
-            scattered = ray(rec.p, scatter_direction);
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            srec.scattered = ray(rec.p, scatter_direction);
+            srec.attenuation = albedo;
+            srec.is_specular = false;
             return true;
         }
 
@@ -42,12 +87,13 @@ class metal : public material {
        metal(const color& a, double f) : albedo(a), fuzz(f < 1 ? f : 1) {}
 
        virtual bool scatter(
-           const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+           const ray& r_in, const hit_record& rec, scatter_record& srec
        ) const override {
            vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-           scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
-           attenuation = albedo;
-           return (dot(scattered.direction(), rec.normal) > 0);
+           srec.scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
+           srec.attenuation = albedo;
+           srec.is_specular = true;
+           return (dot(srec.scattered.direction(), rec.normal) > 0);
        }
 
    public:
@@ -59,9 +105,10 @@ class dielectric : public material {
     public:
         dielectric(double index_of_refraction) : ir(index_of_refraction) {}
         virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+            const ray& r_in, const hit_record& rec, scatter_record& srec
         ) const override {
-            attenuation = color(1.0, 1.0, 1.0);
+            srec.attenuation = color(1.0, 1.0, 1.0);
+            srec.is_specular = true;
             double refraction_ratio = rec.front_face ? (1.0/ir) : ir;
 
             vec3 unit_direction = unit_vector(r_in.direction());
@@ -76,7 +123,7 @@ class dielectric : public material {
             else
                 direction = refract(unit_direction, rec.normal, refraction_ratio);
 
-            scattered = ray(rec.p, direction);
+            srec.scattered = ray(rec.p, direction);
             return true;
         }
 
@@ -88,7 +135,7 @@ class dielectric : public material {
             // Use Schlick's approximation for reflectance.
             auto r0 = (1-ref_idx) / (1+ref_idx);
             r0 = r0*r0;
-            return r0 + (1-r0)*pow((1 - cosine),5);
+            return r0 + (1-r0)*pow5(1 - cosine);
         }
 };
 
@@ -96,27 +143,41 @@ class dielectric : public material {
 // Implementando classe de marmore
 class marble : public material {
     public:
-        marble(const color& a) : albedo(make_shared<solid_color>(a)) {}
+        marble(const color& a) : albedo(make_scene_ptr<solid_color>(a)) {}
         marble(shared_ptr<texture> a) : albedo(a) {}
 
         virtual bool scatter(
-            const ray& r_in, const hit_record& rec, color& attenuation, ray& scattered
+            const ray& r_in, const hit_record& rec, scatter_record& srec
         ) const override {
+            color albedo_color;
+            {
+                perf_phase phase(render_phase::texture_lookup);
+                albedo_color = albedo->value(rec.u, rec.v, rec.p);
+            }
+            return scatter_with(albedo_color, r_in, rec, srec);
+        }
+
+        // Scatter kernel with the albedo already looked up, shared with material_table.
+        static bool scatter_with(
+            const color& albedo, const ray& r_in, const hit_record& rec, scatter_record& srec
+        ) {
             auto scatter_direction = rec.normal + random_unit_vector();
 
             // Catch degenerate scatter direction
             if (scatter_direction.near_zero())
                 scatter_direction = rec.normal;
 
-            scattered = ray(rec.p, scatter_direction);
-            attenuation = albedo->value(rec.u, rec.v, rec.p);
+            srec.scattered = ray(rec.p, scatter_direction);
+            srec.attenuation = albedo;
+            srec.is_specular = false;
 
             if (random_double() > 0.3) {
                 double fuzz = 0.4;
                 vec3 reflected = reflect(unit_vector(r_in.direction()), rec.normal);
-                scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
+                srec.scattered = ray(rec.p, reflected + fuzz*random_in_unit_sphere());
+                srec.is_specular = true;
                 // attenuation = albedo2;
-                return (dot(scattered.direction(), rec.normal) > 0);
+                return (dot(srec.scattered.direction(), rec.normal) > 0);
             }
             return true;
 
@@ -127,4 +188,24 @@ class marble : public material {
 };
 
 
+class diffuse_light : public material  {
+    public:
+        diffuse_light(shared_ptr<texture> a) : emit(a) {}
+        diffuse_light(color c) : emit(make_scene_ptr<solid_color>(c)) {}
+
+        virtual bool scatter(
+            const ray& r_in, const hit_record& rec, scatter_record& srec
+        ) const override {
+            return false;
+        }
+
+        virtual color emitted(double u, double v, const point3& p) const override {
+            return emit->value(u, v, p);
+        }
+
+    public:
+        shared_ptr<texture> emit;
+};
+
+
 #endif
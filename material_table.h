@@ -0,0 +1,204 @@
+#ifndef MATERIAL_TABLE_H
+#define MATERIAL_TABLE_H
+
+#include "rtweekend.h"
+
+#include "cylinder.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "paraboloid.h"
+#include "perf_counters.h"
+#include "sphere.h"
+#include "sphere_store.h"
+#include "texture.h"
+
+#include <cstdint>
+#include <typeinfo>
+#include <vector>
+
+
+// Tabela fechada de materiais e texturas da cena.
+//
+// Cada material embutido (lambertian, metal, dielectric, marble, diffuse_light) vira uma
+// entrada com um tipo, e o integrador despacha com um switch em vez de chamadas virtuais.
+// Texturas solid_color sao copiadas para a entrada, entao lambertian(color) nao passa por
+// nenhuma indirecao. So as proprias classes embutidas entram na tabela: subclasses delas,
+// como qualquer outro material ou textura, continuam pelas chamadas virtuais de sempre,
+// entao sobrescrever scatter ou value sempre vale. Cada tabela acha a entrada de um
+// material por um vetor indexado por material::id (a partir do menor id que ela viu), sem
+// escrever nada no material, entao varias tabelas podem compilar os mesmos materiais.
+
+enum class material_kind : uint8_t { lambertian, metal, dielectric, marble, diffuse_light };
+enum class texture_kind : uint8_t { solid, image, noise, noise2, other };
+
+struct material_entry {
+    material_kind kind;
+    texture_kind tex_kind;
+    color constant;        // value of a solid_color texture
+    const material* mat;
+    const texture* tex;    // albedo (or emission) texture, null for metal and dielectric
+};
+
+
+class material_table {
+    public:
+        material_table() {}
+        material_table(const hittable_list& world) { add(world); }
+
+        // Compiles the materials of every built-in primitive in the list.
+        void add(const hittable_list& world);
+
+        // Returns the slot of m, or -1 if it is not one of the built-in classes.
+        int add(const shared_ptr<material>& m);
+
+        // True when every material seen so far took the static path.
+        bool closed() const { return open_count == 0; }
+
+        const material_entry* find(const material* m) const {
+            auto k = static_cast<size_t>(m->id - first_id);   // ids below first_id wrap past the end
+            if (k >= slot_of.size() || slot_of[k] < 0)
+                return nullptr;
+            return &entries[slot_of[k]];
+        }
+
+        bool scatter(
+            const material_entry& e, const ray& r_in, const hit_record& rec, scatter_record& srec
+        ) const {
+            switch (e.kind) {
+                case material_kind::lambertian:
+                    return lambertian::scatter_with(texture_value(e, rec), rec, srec);
+                case material_kind::marble:
+                    return marble::scatter_with(texture_value(e, rec), r_in, rec, srec);
+                case material_kind::metal:
+                    return static_cast<const metal*>(e.mat)->metal::scatter(r_in, rec, srec);
+                case material_kind::dielectric:
+                    return static_cast<const dielectric*>(e.mat)->dielectric::scatter(r_in, rec, srec);
+                case material_kind::diffuse_light:
+                    return false;
+            }
+            return false;
+        }
+
+        color emitted(const material_entry& e, const hit_record& rec) const {
+            if (e.kind != material_kind::diffuse_light)
+                return color(0,0,0);
+            return texture_value(e, rec);
+        }
+
+    public:
+        std::vector<material_entry> entries;
+
+    private:
+        color texture_value(const material_entry& e, const hit_record& rec) const {
+            if (e.tex_kind == texture_kind::solid)
+                return e.constant;
+
+            perf_phase phase(render_phase::texture_lookup);
+            switch (e.tex_kind) {
+                case texture_kind::solid:
+                    return e.constant;
+                case texture_kind::image:
+                    return static_cast<const image_texture*>(e.tex)->image_texture::value(rec.u, rec.v, rec.p);
+                case texture_kind::noise:
+                    return static_cast<const noise_texture*>(e.tex)->noise_texture::value(rec.u, rec.v, rec.p);
+                case texture_kind::noise2:
+                    return static_cast<const noise_texture2*>(e.tex)->noise_texture2::value(rec.u, rec.v, rec.p);
+                case texture_kind::other:
+                    break;
+            }
+            return e.tex->value(rec.u, rec.v, rec.p);
+        }
+
+        // Exact types only: a subclass may override value().
+        static texture_kind classify(const texture* t, color& constant) {
+            const auto& type = typeid(*t);
+            if (type == typeid(solid_color)) {
+                constant = static_cast<const solid_color*>(t)->color_value;
+                return texture_kind::solid;
+            }
+            if (type == typeid(image_texture))
+                return texture_kind::image;
+            if (type == typeid(noise_texture))
+                return texture_kind::noise;
+            if (type == typeid(noise_texture2))
+                return texture_kind::noise2;
+            return texture_kind::other;
+        }
+
+    private:
+        std::vector<shared_ptr<material>> materials;  // keeps compiled entries alive
+        std::vector<int> slot_of;   // entry of material first_id + k, or -1
+        uint32_t first_id = 0;
+        int open_count = 0;
+};
+
+
+void material_table::add(const hittable_list& world) {
+    for (const auto& object : world.objects) {
+        if (auto s = dynamic_cast<const sphere*>(object.get()))
+            add(s->mat_ptr);
+        else if (auto c = dynamic_cast<const cylinder*>(object.get()))
+            add(c->mat_ptr);
+        else if (auto p = dynamic_cast<const paraboloid*>(object.get()))
+            add(p->mat_ptr);
+        else if (auto store = dynamic_cast<const sphere_store*>(object.get()))
+            for (const auto& m : store->materials)
+                add(m);
+        else if (auto moved = dynamic_cast<const translate*>(object.get()))
+            add(hittable_list(moved->ptr));
+        else if (auto list = dynamic_cast<const hittable_list*>(object.get()))
+            add(*list);
+        else
+            open_count++;
+    }
+}
+
+
+int material_table::add(const shared_ptr<material>& m) {
+    if (!m)
+        return -1;
+    if (auto known = find(m.get()))
+        return static_cast<int>(known - entries.data());
+
+    material_entry e = {material_kind::lambertian, texture_kind::other, color(0,0,0), m.get(), nullptr};
+
+    // Exact types only: subclasses keep their own scatter() through the virtual call.
+    const auto& type = typeid(*m);
+    if (type == typeid(lambertian)) {
+        e.tex = static_cast<const lambertian*>(m.get())->albedo.get();
+    } else if (type == typeid(marble)) {
+        e.kind = material_kind::marble;
+        e.tex = static_cast<const marble*>(m.get())->albedo.get();
+    } else if (type == typeid(diffuse_light)) {
+        e.kind = material_kind::diffuse_light;
+        e.tex = static_cast<const diffuse_light*>(m.get())->emit.get();
+    } else if (type == typeid(metal)) {
+        e.kind = material_kind::metal;
+    } else if (type == typeid(dielectric)) {
+        e.kind = material_kind::dielectric;
+    } else {
+        open_count++;
+        return -1;
+    }
+
+    if (e.tex)
+        e.tex_kind = classify(e.tex, e.constant);
+
+    auto slot = static_cast<int>(entries.size());
+    if (slot_of.empty())
+        first_id = m->id;
+    if (m->id < first_id) {
+        slot_of.insert(slot_of.begin(), first_id - m->id, -1);
+        first_id = m->id;
+    }
+    if (m->id - first_id >= slot_of.size())
+        slot_of.resize(m->id - first_id + 1, -1);
+    slot_of[m->id - first_id] = slot;
+    entries.push_back(e);
+    materials.push_back(m);
+    return slot;
+}
+
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef MEMORY_STATS_H
+#define MEMORY_STATS_H
+
+#include <atomic>
+#include <cstddef>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <type_traits>
+
+
+// Contabilidade de memoria por subsistema.
+//
+// Cada alocacao grande ou de cena e anotada com uma categoria (memory_tag): os objetos
+// criados com make_scene_ptr (primitivas, materiais, texturas e os blocos de controle dos
+// shared_ptr), os pixels das image_texture, as tabelas do perlin, as arvores, os caches
+// de luz e os framebuffers. Para cada categoria guardamos os bytes em uso e o pico, em
+// contadores atomicos relaxados; so as alocacoes pagam, nunca o laco dos raios.
+// write_memory_report imprime a tabela; memory_usage consulta uma categoria a qualquer
+// momento. Compilando com RT_NO_MEMORY_STATS tudo vira codigo vazio.
+//
+// Os numeros sao os bytes pedidos, sem a sobra dos blocos da arena nem o cabecalho do
+// malloc.
+
+class hittable;
+class material;
+class texture;
+
+enum class memory_tag {
+    primitives,       // hittables made with make_scene_ptr, sphere_store spheres
+    control_blocks,   // shared_ptr control blocks of those objects
+    materials,
+    textures,         // texture objects, without their pixels
+    image_pixels,     // decoded image_texture data
+    perlin,           // perlin gradient and permutation tables
+    acceleration,     // qbvh nodes and primitive references
+    light_caches,     // photon maps and irradiance caches
+    framebuffers,
+    count
+};
+
+struct memory_usage_info {
+    size_t current = 0;
+    size_t peak = 0;
+};
+
+inline const char* memory_tag_name(memory_tag tag) {
+    static const char* names[] = {
+        "primitives", "control blocks", "materials", "textures", "image pixels",
+        "perlin", "acceleration", "light caches", "framebuffers"
+    };
+    return names[static_cast<int>(tag)];
+}
+
+
+#if defined(RT_NO_MEMORY_STATS)
+
+inline void memory_add(memory_tag, size_t) {}
+inline void memory_remove(memory_tag, size_t) {}
+inline memory_usage_info memory_usage(memory_tag) { return {}; }
+
+#else
+
+struct memory_counter {
+    std::atomic<size_t> current{0};
+    std::atomic<size_t> peak{0};
+};
+
+inline memory_counter* memory_counters() {
+    static memory_counter counters[static_cast<int>(memory_tag::count)];
+    return counters;
+}
+
+inline void memory_add(memory_tag tag, size_t bytes) {
+    auto& c = memory_counters()[static_cast<int>(tag)];
+    auto now = c.current.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+    auto peak = c.peak.load(std::memory_order_relaxed);
+    while (now > peak && !c.peak.compare_exchange_weak(peak, now, std::memory_order_relaxed)) {}
+}
+
+inline void memory_remove(memory_tag tag, size_t bytes) {
+    memory_counters()[static_cast<int>(tag)].current.fetch_sub(bytes, std::memory_order_relaxed);
+}
+
+inline memory_usage_info memory_usage(memory_tag tag) {
+    auto& c = memory_counters()[static_cast<int>(tag)];
+    return {c.current.load(std::memory_order_relaxed), c.peak.load(std::memory_order_relaxed)};
+}
+
+#endif
+
+
+// Table of current and peak bytes per category, then the totals. The total peak adds
+// the peaks of each category, which need not have happened at the same time.
+inline void write_memory_report(std::ostream& out) {
+#if defined(RT_NO_MEMORY_STATS)
+    out << "Memory accounting disabled (RT_NO_MEMORY_STATS).\n";
+#else
+    auto mib = [](size_t bytes) { return bytes / (1024.0 * 1024.0); };
+    memory_usage_info total;
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+    out << std::left << std::setw(16) << "Memory (MiB)" << std::right
+        << std::setw(12) << "current" << std::setw(12) << "peak" << '\n';
+    for (int t = 0; t < static_cast<int>(memory_tag::count); t++) {
+        auto usage = memory_usage(static_cast<memory_tag>(t));
+        total.current += usage.current;
+        total.peak += usage.peak;
+        out << std::left << std::setw(16) << memory_tag_name(static_cast<memory_tag>(t)) << std::right
+            << std::setw(12) << mib(usage.current) << std::setw(12) << mib(usage.peak) << '\n';
+    }
+    out << std::left << std::setw(16) << "total" << std::right
+        << std::setw(12) << mib(total.current) << std::setw(12) << mib(total.peak) << '\n';
+    out.flags(flags);
+    out.precision(precision);
+#endif
+}
+
+
+// Category of an object made with make_scene_ptr.
+template<class T>
+constexpr memory_tag memory_tag_of() {
+    return std::is_base_of<hittable, T>::value ? memory_tag::primitives
+         : std::is_base_of<material, T>::value ? memory_tag::materials
+         : std::is_base_of<texture, T>::value ? memory_tag::textures
+         : memory_tag::primitives;
+}
+
+
+// Bytes held by the owner under one category, for memory that is not allocated through
+// make_scene_ptr (stb pixels, vectors). Copies charge again; the destructor gives back.
+class memory_charge {
+    public:
+        explicit memory_charge(memory_tag t, size_t b = 0) : tag(t), bytes(b) { memory_add(tag, bytes); }
+        memory_charge(const memory_charge& other) : memory_charge(other.tag, other.bytes) {}
+        ~memory_charge() { memory_remove(tag, bytes); }
+
+        memory_charge& operator=(const memory_charge& other) {
+            set(other.bytes);
+            return *this;
+        }
+
+        // Replaces the charge with `b` bytes.
+        void set(size_t b) {
+            memory_add(tag, b);
+            memory_remove(tag, bytes);
+            bytes = b;
+        }
+
+    private:
+        memory_tag tag;
+        size_t bytes;
+};
+
+
+// Allocator for allocate_shared: charges sizeof(Object) to the object's category and the
+// rest of each block to control_blocks.
+template<class T, class Object>
+struct tagged_allocator {
+    using value_type = T;
+
+    tagged_allocator() {}
+    template<class U>
+    tagged_allocator(const tagged_allocator<U, Object>&) {}
+
+    T* allocate(size_t n) {
+        auto p = std::allocator<T>().allocate(n);
+        charge(n, true);
+        return p;
+    }
+
+    void deallocate(T* p, size_t n) {
+        charge(n, false);
+        std::allocator<T>().deallocate(p, n);
+    }
+
+    // Splits a block of n T's as described above; used by the scene arena too.
+    static void charge(size_t n, bool add) {
+        auto bytes = n * sizeof(T);
+        auto object = bytes >= sizeof(Object) ? sizeof(Object) : bytes;
+        auto tag = memory_tag_of<Object>();
+        if (add) {
+            memory_add(tag, object);
+            memory_add(memory_tag::control_blocks, bytes - object);
+        } else {
+            memory_remove(tag, object);
+            memory_remove(memory_tag::control_blocks, bytes - object);
+        }
+    }
+
+    template<class U>
+    struct rebind { using other = tagged_allocator<U, Object>; };
+
+    template<class U>
+    bool operator==(const tagged_allocator<U, Object>&) const { return true; }
+    template<class U>
+    bool operator!=(const tagged_allocator<U, Object>&) const { return false; }
+};
+
+
+#endif
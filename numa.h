@@ -0,0 +1,195 @@
+#ifndef NUMA_H
+#define NUMA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// Maquinas com mais de um no NUMA.
+//
+// A topologia vem de /sys/devices/system/node (so Linux, sem libnuma): a lista de CPUs de
+// cada no, restrita as CPUs em que o processo pode rodar. Nos outros sistemas, ou sem o
+// /sys, ha um no so com todas as CPUs, e entao nada aqui muda o comportamento: as threads
+// nao sao fixadas e a memoria fica onde o sistema a pos.
+//
+// Com dois ou mais nos, o pool fixa cada thread numa CPU, alternando os nos (thread_pool.h),
+// e numa_interleave espalha as paginas dos dados so de leitura da cena (arvore, primitivas,
+// texturas) por todos os nos, para que nenhum soquete leia tudo de longe. Os buffers em que
+// cada thread escreve sao tocados primeiro por ela, e o kernel os poe no seu proprio no.
+
+class numa_topology {
+    public:
+        // One node holding the CPUs the process may run on.
+        numa_topology() : node_ids(1, 0), node_cpus(1, allowed_cpus()) {}
+
+        // Reads the nodes from a sysfs directory laid out like /sys/devices/system/node.
+        explicit numa_topology(const std::string& sysfs_root);
+
+        // The machine's topology, read once.
+        static const numa_topology& system() {
+            static numa_topology topology("/sys/devices/system/node");
+            return topology;
+        }
+
+        int nodes() const { return static_cast<int>(node_cpus.size()); }
+        bool multi_node() const { return node_cpus.size() > 1; }
+
+        // Node of a CPU, 0 if it is not listed.
+        int node_of(int cpu) const {
+            for (int n = 0; n < nodes(); n++)
+                if (std::find(node_cpus[n].begin(), node_cpus[n].end(), cpu) != node_cpus[n].end())
+                    return n;
+            return 0;
+        }
+
+        // Node of the CPU the caller runs on right now, 0 when unknown.
+        int current_node() const {
+#if defined(__linux__)
+            if (multi_node())
+                return node_of(sched_getcpu());
+#endif
+            return 0;
+        }
+
+        // CPU for pool thread i: the threads take the nodes in turn, and within a node its
+        // CPUs in order.
+        int cpu_for_thread(unsigned i) const {
+            const auto& cpus = node_cpus[i % node_cpus.size()];
+            return cpus[(i / node_cpus.size()) % cpus.size()];
+        }
+
+        // Parses a sysfs cpulist such as "0-3,8-11".
+        static std::vector<int> parse_cpu_list(const std::string& text);
+
+    public:
+        std::vector<int> node_ids;                 // the system's number for each node
+        std::vector<std::vector<int>> node_cpus;   // never empty, nor is any entry
+
+    private:
+        static std::vector<int> allowed_cpus();
+};
+
+
+numa_topology::numa_topology(const std::string& sysfs_root) {
+    auto allowed = allowed_cpus();
+    std::string text;
+    std::ifstream online(sysfs_root + "/online");
+    std::getline(online, text);
+
+    // Nodes with memory but no usable CPU are left out: no thread runs there.
+    for (auto node : parse_cpu_list(text)) {
+        std::ifstream in(sysfs_root + "/node" + std::to_string(node) + "/cpulist");
+        if (!std::getline(in, text))
+            continue;
+        std::vector<int> cpus;
+        for (auto cpu : parse_cpu_list(text))
+            if (std::find(allowed.begin(), allowed.end(), cpu) != allowed.end())
+                cpus.push_back(cpu);
+        if (!cpus.empty()) {
+            node_ids.push_back(node);
+            node_cpus.push_back(cpus);
+        }
+    }
+    if (node_cpus.empty()) {
+        node_ids.assign(1, 0);
+        node_cpus.assign(1, allowed);
+    }
+}
+
+
+std::vector<int> numa_topology::parse_cpu_list(const std::string& text) {
+    std::vector<int> cpus;
+    std::stringstream list(text);
+    std::string range;
+    while (std::getline(list, range, ',')) {
+        int first, last;
+        auto dash = range.find('-');
+        try {
+            first = std::stoi(range.substr(0, dash));
+            last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        } catch (...) {
+            continue;
+        }
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+
+std::vector<int> numa_topology::allowed_cpus() {
+    std::vector<int> cpus;
+#if defined(__linux__)
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+#endif
+    if (cpus.empty())
+        cpus.push_back(0);
+    return cpus;
+}
+
+
+// Pins the calling thread to one CPU. Returns false where that is not possible.
+bool pin_current_thread(int cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return sched_setaffinity(0, sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+
+// Spreads the whole pages inside [p, p + bytes) round-robin over the nodes of the
+// topology, moving the ones already touched. Does nothing on a single node; a failure
+// is reported once and the memory stays where it is.
+void numa_interleave(const void* p, size_t bytes, const numa_topology& topology = numa_topology::system()) {
+#if defined(__linux__) && defined(SYS_mbind)
+    if (!topology.multi_node() || bytes == 0)
+        return;
+
+    static const uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+    auto begin = (reinterpret_cast<uintptr_t>(p) + page - 1) & ~(page - 1);
+    auto end = (reinterpret_cast<uintptr_t>(p) + bytes) & ~(page - 1);
+    if (begin >= end)
+        return;
+
+    const int mpol_interleave = 3, mpol_mf_move = 1 << 1;
+    const int mask_bits = 1024;
+    unsigned long mask[mask_bits / 64] = {};
+    for (auto node : topology.node_ids)
+        if (node >= 0 && node < mask_bits)
+            mask[node / 64] |= 1ul << (node % 64);
+
+    if (syscall(SYS_mbind, begin, end - begin, mpol_interleave, mask, mask_bits + 1, mpol_mf_move) != 0) {
+        static std::atomic<bool> reported{false};
+        if (!reported.exchange(true))
+            std::cerr << "ERROR: Could not interleave scene memory across NUMA nodes; leaving it in place.\n";
+    }
+#else
+    (void)p;
+    (void)bytes;
+    (void)topology;
+#endif
+}
+
+
+#endif
@@ -19,6 +19,10 @@ class paraboloid : public hittable {
         virtual bool hit(
             const ray &r, double t_min, double t_max, hit_record &rec) const override;
 
+        // O limite de altura so e aplicado a primeira raiz, entao a superficie
+        // nao e limitada: sem caixa, a BVH testa o paraboloide separadamente.
+        virtual bool bounding_box(aabb& output_box) const override { return false; }
+
     public:
         point3 center;
         double value_A;
@@ -70,6 +74,7 @@ bool paraboloid::hit(const ray &r, double t_min, double t_max, hit_record &rec)
     vec3 outward_normal = (rec.p - center) / value_A*value_A*value_B*value_B;
     rec.set_face_normal(r, outward_normal);
     rec.mat_ptr = mat_ptr;
+    rec.object = this;
     return true;
 }
 
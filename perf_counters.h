@@ -0,0 +1,362 @@
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+// Contadores de hardware por fase da renderizacao.
+//
+// Com perf_counters::enable(), cada thread que entra numa fase (perf_phase) abre o seu
+// proprio grupo de contadores com perf_event_open: ciclos, instrucoes, cache misses e
+// branch mispredicts, so em modo usuario. A cada troca de fase o grupo e lido e a
+// diferenca vai para a fase mais interna em andamento, entao uma busca de textura no meio
+// de um quique conta como textura e nao como quique. Os totais de cada thread sao somados
+// no relatorio; se o kernel multiplexou os contadores, os valores sao escalados pelo
+// tempo em que o grupo esteve ativo.
+//
+// Cada troca de fase custa uma chamada de sistema (read) por thread, cerca de um
+// microssegundo, o que pesa nas fases curtas como as buscas de textura: os numeros
+// servem para comparar fases e versoes, nao como tempo absoluto. Desligado (o padrao), um
+// perf_phase custa a leitura de um bool. Onde os contadores nao existem ou nao sao
+// permitidos (perf_event_paranoid, containers, outros sistemas), enable() diz por que e
+// devolve false, e nada e contado.
+
+enum class render_phase {
+    scene_build,
+    primary_rays,        // camera rays: traversal and shading at the first hit
+    secondary_bounces,
+    texture_lookup,
+    output,
+    count
+};
+
+inline const char* render_phase_name(render_phase phase) {
+    static const char* names[] = {
+        "scene build", "primary rays", "secondary bounces", "texture lookup", "output"
+    };
+    return names[static_cast<int>(phase)];
+}
+
+
+class perf_counters {
+    public:
+        static constexpr int event_count = 4;   // cycles, instructions, cache misses, branch misses
+
+        // Turns counting on for every thread from its next phase on. False, with the
+        // reason on std::cerr, when the counters cannot be opened on this machine.
+        static bool enable();
+
+        static bool enabled() { return on().load(std::memory_order_relaxed); }
+
+        // Counts of every phase, summed over the threads that took part. Phases that no
+        // thread entered, because the render mode has no scope for them, read "not measured".
+        static void write_report(std::ostream& out);
+
+    private:
+        friend class perf_phase;
+
+        static constexpr int phase_count = static_cast<int>(render_phase::count);
+        static constexpr int max_depth = 16;
+
+        // Totals of one thread, kept after it exits for the report.
+        struct totals {
+            std::atomic<uint64_t> value[phase_count][event_count] = {};
+            std::atomic<uint64_t> enabled[phase_count] = {};   // ns the group was enabled
+            std::atomic<uint64_t> running[phase_count] = {};   // ns it was counting
+            std::atomic<bool> entered[phase_count] = {};        // some scope opened the phase
+            bool available[event_count] = {};                  // set before it is shared
+        };
+
+        struct thread_state {
+            int fd[event_count] = {-1, -1, -1, -1};
+            int slot[event_count] = {-1, -1, -1, -1};   // position of each event in a group read
+            bool opened = false;
+            int error = 0;   // errno of a failed open
+            uint64_t last[event_count] = {};
+            uint64_t last_enabled = 0, last_running = 0;
+            render_phase stack[max_depth];
+            int depth = 0;
+            std::shared_ptr<totals> sums;
+
+            ~thread_state() {
+#if defined(__linux__)
+                for (auto f : fd)
+                    if (f >= 0)
+                        close(f);
+#endif
+            }
+        };
+
+        static std::atomic<bool>& on() {
+            static std::atomic<bool> flag{false};
+            return flag;
+        }
+
+        static std::mutex& registry_mutex() {
+            static std::mutex mutex;
+            return mutex;
+        }
+
+        static std::vector<std::shared_ptr<totals>>& registry() {
+            static std::vector<std::shared_ptr<totals>> all;
+            return all;
+        }
+
+        static thread_state& current() {
+            thread_local thread_state state;
+            return state;
+        }
+
+        // Opens the group of event i; returns the fd or -1 with errno set.
+        static int open_event(int i, int group);
+
+        static bool open(thread_state& s);
+
+        static void mark(thread_state& s, render_phase phase) {
+            if (s.sums)
+                s.sums->entered[static_cast<int>(phase)].store(true, std::memory_order_relaxed);
+        }
+
+        // Reads the group and charges what happened since the last read to the phase on
+        // top of the stack.
+        static void charge(thread_state& s);
+
+        static void enter(render_phase phase);
+        static void leave();
+        static void change(render_phase phase);
+};
+
+
+// Counts the enclosing block as `phase` on the calling thread.
+class perf_phase {
+    public:
+        explicit perf_phase(render_phase phase) : active(perf_counters::enabled()) {
+            if (active)
+                perf_counters::enter(phase);
+        }
+
+        ~perf_phase() {
+            if (active)
+                perf_counters::leave();
+        }
+
+        perf_phase(const perf_phase&) = delete;
+        perf_phase& operator=(const perf_phase&) = delete;
+
+        // Counts the rest of the block as another phase.
+        void change(render_phase phase) {
+            if (active)
+                perf_counters::change(phase);
+        }
+
+        // Ends the phase before the block does.
+        void finish() {
+            if (active)
+                perf_counters::leave();
+            active = false;
+        }
+
+    private:
+        bool active;
+};
+
+
+int perf_counters::open_event(int i, int group) {
+#if defined(__linux__) && defined(SYS_perf_event_open)
+    static const uint64_t configs[event_count] = {
+        PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+        PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+    };
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = configs[i];
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, 0));
+#else
+    (void)i;
+    (void)group;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+
+bool perf_counters::open(thread_state& s) {
+    s.opened = true;
+    s.fd[0] = open_event(0, -1);
+    if (s.fd[0] < 0) {
+        s.error = errno;
+        return false;
+    }
+
+    // Events the hardware lacks are left out of the group and reported as n/a.
+    int members = 1;
+    s.slot[0] = 0;
+    for (int i = 1; i < event_count; i++) {
+        s.fd[i] = open_event(i, s.fd[0]);
+        if (s.fd[i] >= 0)
+            s.slot[i] = members++;
+    }
+
+    s.sums = std::make_shared<totals>();
+    for (int i = 0; i < event_count; i++)
+        s.sums->available[i] = s.slot[i] >= 0;
+    std::lock_guard<std::mutex> lock(registry_mutex());
+    registry().push_back(s.sums);
+    return true;
+}
+
+
+bool perf_counters::enable() {
+    auto& s = current();
+    if (!s.opened)
+        open(s);
+    if (s.fd[0] < 0) {
+#if defined(__linux__)
+        std::cerr << "ERROR: Could not open hardware performance counters (" << std::strerror(s.error)
+                  << "); see /proc/sys/kernel/perf_event_paranoid. Rendering without them.\n";
+#else
+        std::cerr << "ERROR: Hardware performance counters need Linux. Rendering without them.\n";
+#endif
+        return false;
+    }
+    on() = true;
+    return true;
+}
+
+
+void perf_counters::charge(thread_state& s) {
+#if defined(__linux__)
+    uint64_t data[3 + event_count];
+    if (s.fd[0] < 0 || read(s.fd[0], data, sizeof(data)) < static_cast<ssize_t>(3 * sizeof(uint64_t)))
+        return;
+
+    uint64_t now[event_count] = {};
+    for (int i = 0; i < event_count; i++)
+        if (s.slot[i] >= 0 && static_cast<uint64_t>(s.slot[i]) < data[0])
+            now[i] = data[3 + s.slot[i]];
+
+    if (s.depth > 0) {
+        auto phase = static_cast<int>(s.stack[std::min(s.depth, max_depth) - 1]);
+        for (int i = 0; i < event_count; i++)
+            s.sums->value[phase][i].fetch_add(now[i] - s.last[i], std::memory_order_relaxed);
+        s.sums->enabled[phase].fetch_add(data[1] - s.last_enabled, std::memory_order_relaxed);
+        s.sums->running[phase].fetch_add(data[2] - s.last_running, std::memory_order_relaxed);
+    }
+    for (int i = 0; i < event_count; i++)
+        s.last[i] = now[i];
+    s.last_enabled = data[1];
+    s.last_running = data[2];
+#else
+    (void)s;
+#endif
+}
+
+
+void perf_counters::enter(render_phase phase) {
+    auto& s = current();
+    if (!s.opened)
+        open(s);
+    charge(s);
+    mark(s, phase);
+    if (s.depth < max_depth)
+        s.stack[s.depth] = phase;
+    s.depth++;
+}
+
+
+void perf_counters::leave() {
+    auto& s = current();
+    charge(s);
+    s.depth--;
+}
+
+
+void perf_counters::change(render_phase phase) {
+    auto& s = current();
+    charge(s);
+    mark(s, phase);
+    if (s.depth > 0 && s.depth <= max_depth)
+        s.stack[s.depth - 1] = phase;
+}
+
+
+void perf_counters::write_report(std::ostream& out) {
+    if (!enabled())
+        return;
+
+    double sums[phase_count][event_count] = {};
+    bool available[event_count] = {};
+    bool measured[phase_count] = {};
+    size_t threads = 0;
+    {
+        std::lock_guard<std::mutex> lock(registry_mutex());
+        for (const auto& t : registry()) {
+            threads++;
+            for (int i = 0; i < event_count; i++)
+                available[i] = available[i] || t->available[i];
+            for (int p = 0; p < phase_count; p++) {
+                measured[p] = measured[p] || t->entered[p].load(std::memory_order_relaxed);
+                auto running = t->running[p].load(std::memory_order_relaxed);
+                auto scale = running ? double(t->enabled[p].load(std::memory_order_relaxed)) / running : 0.0;
+                for (int i = 0; i < event_count; i++)
+                    sums[p][i] += scale * t->value[p][i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    auto flags = out.flags();
+    auto precision = out.precision();
+    out << std::fixed << std::setprecision(2);
+    out << "Hardware counters, " << threads << " threads (millions; IPC and misses per 1000 instructions)\n"
+        << std::left << std::setw(20) << "phase" << std::right << std::setw(12) << "cycles"
+        << std::setw(14) << "instructions" << std::setw(8) << "IPC" << std::setw(14) << "cache miss"
+        << std::setw(8) << "/1k" << std::setw(14) << "branch miss" << std::setw(8) << "/1k" << '\n';
+    // A column is n/a when no thread could count its event.
+    auto cell = [&](int width, bool known, double value) {
+        if (known)
+            out << std::setw(width) << value;
+        else
+            out << std::setw(width) << "n/a";
+    };
+    for (int p = 0; p < phase_count; p++) {
+        const auto& v = sums[p];
+        out << std::left << std::setw(20) << render_phase_name(static_cast<render_phase>(p)) << std::right;
+        if (!measured[p]) {
+            out << std::setw(12) << "not measured" << '\n';
+            continue;
+        }
+        cell(12, available[0], v[0] / 1e6);
+        cell(14, available[1], v[1] / 1e6);
+        cell(8, available[0] && available[1], v[0] > 0 ? v[1] / v[0] : 0.0);
+        cell(14, available[2], v[2] / 1e6);
+        cell(8, available[1] && available[2], v[1] > 0 ? 1000 * v[2] / v[1] : 0.0);
+        cell(14, available[3], v[3] / 1e6);
+        cell(8, available[1] && available[3], v[1] > 0 ? 1000 * v[3] / v[1] : 0.0);
+        out << '\n';
+    }
+    out.flags(flags);
+    out.precision(precision);
+}
+
+
+#endif
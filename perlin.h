@@ -13,6 +13,9 @@
 
 #include "rtweekend.h"
 
+#include "fast_math.h"
+#include "memory_stats.h"
+
 
 
 class perlin {
@@ -36,12 +39,13 @@ class perlin {
         }
 
         double noise(const point3& p) const {
-            auto u = p.x() - floor(p.x());
-            auto v = p.y() - floor(p.y());
-            auto w = p.z() - floor(p.z());
-            auto i = static_cast<int>(floor(p.x()));
-            auto j = static_cast<int>(floor(p.y()));
-            auto k = static_cast<int>(floor(p.z()));
+            auto fx = fast_floor(p.x()), fy = fast_floor(p.y()), fz = fast_floor(p.z());
+            auto u = p.x() - fx;
+            auto v = p.y() - fy;
+            auto w = p.z() - fz;
+            auto i = static_cast<int>(fx);
+            auto j = static_cast<int>(fy);
+            auto k = static_cast<int>(fz);
             vec3 c[2][2][2];
 
             for (int di=0; di < 2; di++)
@@ -76,6 +80,7 @@ class perlin {
         int* perm_x;
         int* perm_y;
         int* perm_z;
+        memory_charge tables{memory_tag::perlin, point_count * (sizeof(vec3) + 3 * sizeof(int))};
 
         static int* perlin_generate_perm() {
             auto p = new int[point_count];
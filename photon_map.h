@@ -0,0 +1,385 @@
+#ifndef PHOTON_MAP_H
+#define PHOTON_MAP_H
+
+#include "rtweekend.h"
+
+#include "environment.h"
+#include "hittable.h"
+#include "hittable_list.h"
+#include "material.h"
+#include "material_table.h"
+#include "memory_stats.h"
+#include "onb.h"
+#include "sphere.h"
+#include "sphere_store.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+
+// Mapa de fotons para causticas.
+//
+// Antes de renderizar, fotons saem das luzes esfericas da lista de luzes e de um mapa de
+// ambiente (HDR) mirando os objetos especulares (vidro e metal), atravessam os quiques
+// especulares e sao guardados na primeira superficie difusa. Na renderizacao, cada
+// quique difuso soma a densidade de fotons em volta do ponto, e os caminhos que chegam a
+// uma dessas luzes por difuso -> especular(es) deixam de contar a luz, que ja esta no
+// mapa. Assim as causticas, que o path tracing quase nunca acha, convergem com poucas
+// amostras.
+//
+// Os fotons ficam numa grade com hash, ordenados por celula: a busca de um raio r le no
+// maximo 8 celulas contiguas. Fotons e grade sao montados em paralelo no pool.
+//
+// O ceu em gradiente nao emite fotons: ele e largo e suave, e o path tracing ja resolve o
+// que passa pelo vidro vindo dele; fotons dele so espalhariam pontos pelo chao. Tambem so
+// luzes esfericas emitem (as outras seguem so pelo path tracing), e objetos especulares
+// dentro de um sphere_store nao sao alvos.
+
+struct photon {
+    float position[3];
+    float power[3];
+    float direction[3];   // of travel, towards the surface
+};
+
+
+class photon_map {
+    public:
+        photon_map() {}
+
+        // Traces about `count` photons through the specular objects of `world` (the
+        // hittable_list the scene was built from; `scene` is what rays are traced
+        // against, e.g. its qbvh) and indexes them for lookups of the given radius.
+        void build(
+            const hittable_list& world, const hittable& scene, const hittable_list& lights,
+            const environment& env, const material_table* materials, size_t count,
+            double radius, int max_bounces = 8, thread_pool& pool = default_thread_pool());
+
+        bool empty() const { return photons.empty(); }
+        size_t size() const { return photons.size(); }
+
+        // True if photons were traced from this emitter (hit_record::object of a light),
+        // or from the environment.
+        bool covers(const void* emitter) const {
+            return std::find(emitters.begin(), emitters.end(), emitter) != emitters.end();
+        }
+        bool covers_environment() const { return from_environment; }
+
+        // True if photons were aimed at this primitive. Only light that left one of
+        // these last, before reaching a diffuse surface, is in the map.
+        bool targets(const void* object) const {
+            return std::binary_search(target_ids.begin(), target_ids.end(), object);
+        }
+
+        // Caustic radiance leaving a white lambertian surface at p, i.e. the photon
+        // irradiance within the radius divided by pi; multiply by the albedo.
+        color radiance(const point3& p, const vec3& normal) const;
+
+    private:
+        struct target {
+            const void* id;       // hit_record::object of the specular primitive
+            point3 center;        // its bounding sphere
+            double radius;
+        };
+
+        static void collect_targets(
+            const hittable_list& world, const material_table* materials, std::vector<target>& out);
+
+        static bool specular(const shared_ptr<material>& m, const material_table* materials);
+
+        // Emits one photon from source `source` (lights first, the environment last) at
+        // target t and follows it; stored photons go to out.
+        void trace(
+            const hittable& scene, const environment& env, const material_table* materials,
+            const target& t, size_t source, double weight, double scene_radius, int max_bounces,
+            std::vector<photon>& out) const;
+
+        uint32_t bucket(long x, long y, long z) const {
+            auto h = splitmix64(static_cast<uint64_t>(x) * 73856093u
+                                ^ static_cast<uint64_t>(y) * 19349663u
+                                ^ static_cast<uint64_t>(z) * 83492791u);
+            return static_cast<uint32_t>(h & mask);
+        }
+
+        long cell(double x) const { return static_cast<long>(floor(x * inverse_cell)); }
+
+    private:
+        std::vector<photon> photons;       // sorted by bucket
+        std::vector<uint32_t> cell_start;  // bucket b holds photons [cell_start[b], cell_start[b+1])
+        uint64_t mask = 0;
+        double gather_radius = 0;
+        double inverse_cell = 0;
+        std::vector<const void*> emitters;
+        std::vector<const void*> target_ids;   // sorted
+        bool from_environment = false;
+        memory_charge storage{memory_tag::light_caches};
+};
+
+
+bool photon_map::specular(const shared_ptr<material>& m, const material_table* materials) {
+    if (!m)
+        return false;
+    if (auto entry = materials ? materials->find(m.get()) : nullptr)
+        return entry->kind == material_kind::metal || entry->kind == material_kind::dielectric;
+    return dynamic_cast<const metal*>(m.get()) || dynamic_cast<const dielectric*>(m.get());
+}
+
+
+void photon_map::collect_targets(
+    const hittable_list& world, const material_table* materials, std::vector<target>& out
+) {
+    for (const auto& object : world.objects) {
+        shared_ptr<material> m;
+        auto inner = object.get();
+        if (auto moved = dynamic_cast<const translate*>(inner))
+            inner = moved->ptr.get();
+
+        if (auto s = dynamic_cast<const sphere*>(inner))
+            m = s->mat_ptr;
+        else if (auto c = dynamic_cast<const cylinder*>(inner))
+            m = c->mat_ptr;
+        else if (auto p = dynamic_cast<const paraboloid*>(inner))
+            m = p->mat_ptr;
+        else if (auto list = dynamic_cast<const hittable_list*>(inner))
+            collect_targets(*list, materials, out);
+
+        aabb box;
+        if (!specular(m, materials) || !object->bounding_box(box))
+            continue;
+        auto center = 0.5 * (box.min() + box.max());
+        out.push_back({object.get(), center, 0.5 * (box.max() - box.min()).length()});
+    }
+}
+
+
+void photon_map::build(
+    const hittable_list& world, const hittable& scene, const hittable_list& lights,
+    const environment& env, const material_table* materials, size_t count, double radius,
+    int max_bounces, thread_pool& pool
+) {
+    std::vector<photon>().swap(photons);
+    std::vector<uint32_t>().swap(cell_start);
+    storage.set(0);
+    emitters.clear();
+    target_ids.clear();
+    from_environment = false;
+    gather_radius = radius;
+    inverse_cell = 1 / (2 * radius);
+
+    std::vector<target> targets;
+    collect_targets(world, materials, targets);
+    if (targets.empty() || count == 0)
+        return;
+
+    for (const auto& t : targets)
+        target_ids.push_back(t.id);
+    std::sort(target_ids.begin(), target_ids.end());
+    for (const auto& light : lights.objects)
+        if (dynamic_cast<const sphere*>(light.get()))
+            emitters.push_back(light.get());
+    from_environment = env.importance_sampled();
+    if (emitters.empty() && !from_environment)
+        return;
+
+    // Environment photons start outside everything.
+    aabb bounds;
+    double scene_radius = 1e4;
+    if (scene.bounding_box(bounds))
+        scene_radius = (bounds.max() - bounds.min()).length();
+
+    // Every (source, target) pair gets the same share of photons.
+    auto sources = emitters.size() + (from_environment ? 1 : 0);
+    auto pairs = sources * targets.size();
+    auto weight = static_cast<double>(pairs) / count;
+
+    const size_t grain = 4096;
+    std::vector<std::vector<photon>> stored((count + grain - 1) / grain);
+    pool.parallel_for(0, count, grain, [&](size_t b, size_t e) {
+        auto& out = stored[b / grain];
+        for (auto i = b; i < e; i++) {
+            auto pair = static_cast<size_t>(random_double() * pairs);
+            pair = std::min(pair, pairs - 1);
+            trace(scene, env, materials, targets[pair % targets.size()],
+                  pair / targets.size(), weight, scene_radius, max_bounces, out);
+        }
+    });
+
+    size_t total = 0;
+    for (const auto& chunk : stored)
+        total += chunk.size();
+
+    // Bucket of every photon, then a counting sort into bucket order.
+    size_t buckets = 1;
+    while (buckets < total)
+        buckets <<= 1;
+    mask = buckets - 1;
+
+    std::vector<photon> unsorted;
+    unsorted.reserve(total);
+    for (auto& chunk : stored) {
+        unsorted.insert(unsorted.end(), chunk.begin(), chunk.end());
+        std::vector<photon>().swap(chunk);
+    }
+
+    std::vector<uint32_t> bucket_of(total);
+    std::vector<std::atomic<uint32_t>> counts(buckets + 1);
+    pool.parallel_for(0, total, grain, [&](size_t b, size_t e) {
+        for (auto i = b; i < e; i++) {
+            const auto& p = unsorted[i].position;
+            bucket_of[i] = bucket(cell(p[0]), cell(p[1]), cell(p[2]));
+            counts[bucket_of[i]].fetch_add(1, std::memory_order_relaxed);
+        }
+    });
+
+    cell_start.resize(buckets + 1);
+    uint32_t offset = 0;
+    for (size_t b = 0; b <= buckets; b++) {
+        cell_start[b] = offset;
+        offset += counts[b].load(std::memory_order_relaxed);
+        counts[b].store(cell_start[b], std::memory_order_relaxed);
+    }
+
+    photons.resize(total);
+    pool.parallel_for(0, total, grain, [&](size_t b, size_t e) {
+        for (auto i = b; i < e; i++)
+            photons[counts[bucket_of[i]].fetch_add(1, std::memory_order_relaxed)] = unsorted[i];
+    });
+    storage.set(photons.capacity() * sizeof(photon) + cell_start.capacity() * sizeof(uint32_t));
+    numa_interleave(photons.data(), photons.size() * sizeof(photon));
+}
+
+
+void photon_map::trace(
+    const hittable& scene, const environment& env, const material_table* materials,
+    const target& t, size_t source, double weight, double scene_radius, int max_bounces,
+    std::vector<photon>& out
+) const {
+    ray r;
+    color power;
+
+    if (source < emitters.size()) {
+        // A point on the light sphere, towards the cone of the target's bounding sphere.
+        auto light = static_cast<const sphere*>(emitters[source]);
+        auto normal = random_unit_vector();
+        auto origin = light->center + light->radius * normal;
+
+        vec3 direction;
+        double direction_pdf;
+        auto to_target = t.center - origin;
+        auto distance_squared = to_target.length_squared();
+        if (distance_squared <= t.radius * t.radius) {
+            direction = random_unit_vector();
+            direction_pdf = 1 / (4*pi);
+        } else {
+            onb uvw;
+            uvw.build_from_w(to_target);
+            direction = uvw.local(random_to_sphere(t.radius, distance_squared));
+            direction_pdf = 1 / (2*pi * (1 - sqrt(1 - t.radius*t.radius / distance_squared)));
+        }
+
+        auto cosine = dot(normal, direction);
+        if (cosine <= 0)
+            return;
+
+        // The light's own hit gives the texture coordinates of its emission.
+        hit_record light_rec;
+        if (!light->hit(ray(origin + normal, -normal), 0.001, infinity, light_rec))
+            return;
+        auto emitted = light_rec.mat_ptr->emitted(light_rec.u, light_rec.v, light_rec.p);
+
+        auto area = 4*pi * light->radius * light->radius;
+        power = emitted * (cosine * area / direction_pdf * weight);
+        r = ray(origin, direction);
+    } else {
+        // A direction of the sky and a point on the disk the target shows it.
+        auto direction = env.importance_sampled() ? env.sample() : random_unit_vector();
+        auto direction_pdf = env.importance_sampled() ? env.pdf_value(direction) : 1 / (4*pi);
+        if (direction_pdf <= 0)
+            return;
+
+        onb uvw;
+        uvw.build_from_w(direction);
+        auto disk = random_in_unit_disk();
+        auto origin = t.center + t.radius * uvw.local(disk.x(), disk.y(), 0)
+                    + (t.radius + scene_radius) * uvw.w();
+
+        power = env.value(direction) * (pi * t.radius * t.radius / direction_pdf * weight);
+        r = ray(origin, -uvw.w());
+    }
+
+    // Only photons that reach their target first; the others belong to another pair.
+    hit_record rec;
+    if (!scene.hit(r, 0.001, infinity, rec) || rec.object != t.id)
+        return;
+
+    for (int bounce = 0; bounce < max_bounces; bounce++) {
+        auto entry = materials ? materials->find(rec.mat_ptr.get()) : nullptr;
+        scatter_record srec;
+        auto scattered = entry ? materials->scatter(*entry, r, rec, srec)
+                               : rec.mat_ptr->scatter(r, rec, srec);
+
+        // Stored wherever a diffuse lobe could have been picked, not just where it was,
+        // since the render gathers with the sampled lobe's weight.
+        auto diffuse = entry ? entry->kind == material_kind::lambertian || entry->kind == material_kind::marble
+                             : scattered && !srec.is_specular;
+        if (bounce > 0 && diffuse) {
+            auto d = unit_vector(r.direction());
+            out.push_back({
+                {float(rec.p.x()), float(rec.p.y()), float(rec.p.z())},
+                {float(power.x()), float(power.y()), float(power.z())},
+                {float(d.x()), float(d.y()), float(d.z())}});
+        }
+
+        if (!scattered || !srec.is_specular)
+            return;
+
+        power = power * srec.attenuation;
+        r = srec.scattered;
+        if (!scene.hit(r, 0.001, infinity, rec))
+            return;
+    }
+}
+
+
+color photon_map::radiance(const point3& p, const vec3& normal) const {
+    if (photons.empty())
+        return color(0,0,0);
+
+    // The sphere of the radius spans two cells on each axis.
+    auto x0 = cell(p.x() - gather_radius), y0 = cell(p.y() - gather_radius), z0 = cell(p.z() - gather_radius);
+    uint32_t seen[8];
+    int seen_count = 0;
+    auto r2 = gather_radius * gather_radius;
+    double sum[3] = {0, 0, 0};
+
+    for (int c = 0; c < 8; c++) {
+        auto b = bucket(x0 + (c & 1), y0 + ((c >> 1) & 1), z0 + (c >> 2));
+        if (std::find(seen, seen + seen_count, b) != seen + seen_count)
+            continue;   // two cells sharing a bucket
+        seen[seen_count++] = b;
+
+        for (auto i = cell_start[b]; i < cell_start[b+1]; i++) {
+            const auto& ph = photons[i];
+            vec3 offset(ph.position[0] - p.x(), ph.position[1] - p.y(), ph.position[2] - p.z());
+            if (offset.length_squared() > r2)
+                continue;
+
+            // Photons from behind the surface, or on another surface across a thin gap.
+            auto arriving = ph.direction[0]*normal.x() + ph.direction[1]*normal.y() + ph.direction[2]*normal.z();
+            if (arriving >= 0 || fabs(dot(offset, normal)) > 0.25 * gather_radius)
+                continue;
+
+            sum[0] += ph.power[0];
+            sum[1] += ph.power[1];
+            sum[2] += ph.power[2];
+        }
+    }
+
+    auto scale = 1 / (pi * r2 * pi);
+    return color(sum[0] * scale, sum[1] * scale, sum[2] * scale);
+}
+
+
+#endif
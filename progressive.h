@@ -0,0 +1,199 @@
+#ifndef PROGRESSIVE_H
+#define PROGRESSIVE_H
+
+#include "rtweekend.h"
+
+#include "color.h"
+#include "memory_stats.h"
+#include "thread_pool.h"
+#include "tile_profiler.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iostream>
+#include <vector>
+
+
+// Renderizacao com prazo.
+//
+// Em vez de um numero fixo de amostras por pixel, a imagem e refinada em passadas ate
+// acabar o tempo. A primeira passada da o mesmo numero de amostras a todos os pixels; nas
+// seguintes, cada tile recebe amostras em proporcao ao erro estimado dos seus pixels (o
+// desvio padrao da media da luminancia, relativo ao brilho). O prazo e conferido a cada
+// pixel, entao a renderizacao para logo depois dele, e cada pixel e dividido pelo seu
+// proprio numero de amostras: a imagem fica correta mesmo com uma passada pela metade.
+
+class progressive_renderer {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        progressive_renderer(int w, int h, int tile = 16)
+            : width(w), height(h), tile_size(std::max(tile, 1)),
+              sum(static_cast<size_t>(w) * h, color(0, 0, 0)),
+              sum_squares(static_cast<size_t>(w) * h, 0.0),
+              count(static_cast<size_t>(w) * h, 0),
+              buffer_bytes(memory_tag::framebuffers,
+                           static_cast<size_t>(w) * h * (sizeof(color) + sizeof(double) + sizeof(int))) {}
+
+        // Refines the image until `seconds` have passed. sample(i, j) returns one sample of
+        // pixel (i, j), with j = 0 the bottom row, and is called from the pool's threads.
+        // Each pass adds about pass_spp samples per pixel on average; with
+        // max_samples_per_pixel > 0 rendering also stops once every pixel has that many.
+        void render(
+            double seconds, const std::function<color(int, int)>& sample, int pass_spp = 4,
+            int max_samples_per_pixel = 0, tile_profiler* profiler = nullptr,
+            thread_pool& pool = default_thread_pool()
+        );
+
+        // Mean of the samples of pixel (i, j), black if it has none.
+        color pixel(int i, int j) const {
+            auto k = index(i, j);
+            return count[k] ? sum[k] / count[k] : color(0, 0, 0);
+        }
+
+        int samples(int i, int j) const { return count[index(i, j)]; }
+        long total_samples() const;
+        int passes() const { return pass_count; }
+
+        int image_width() const { return width; }
+        int image_height() const { return height; }
+
+        // Plain-text PPM, the top row first, like main() writes.
+        void write(std::ostream& out) const {
+            out << "P3\n" << width << ' ' << height << "\n255\n";
+            for (int j = height-1; j >= 0; --j)
+                for (int i = 0; i < width; ++i) {
+                    auto k = index(i, j);
+                    write_color(out, count[k] ? sum[k] : color(0, 0, 0), std::max(count[k], 1));
+                }
+        }
+
+    private:
+        size_t index(int i, int j) const { return static_cast<size_t>(j) * width + i; }
+
+        // Standard error of the pixel mean relative to its brightness.
+        double pixel_error(size_t k) const {
+            if (count[k] < 2)
+                return 1;
+            auto n = static_cast<double>(count[k]);
+            auto mean = luminance(sum[k]) / n;
+            auto variance = std::max(sum_squares[k] / n - mean * mean, 0.0) / (n - 1);
+            return sqrt(variance) / (0.05 + mean);
+        }
+
+        static double luminance(const color& c) {
+            return 0.2126 * c.x() + 0.7152 * c.y() + 0.0722 * c.z();
+        }
+
+    public:
+        // Called after every pass, e.g. to show or send the image so far; returning false
+        // ends the render.
+        std::function<bool()> after_pass;
+
+    private:
+        int width, height, tile_size;
+        std::vector<color> sum;
+        std::vector<double> sum_squares;   // of luminance
+        std::vector<int> count;
+        memory_charge buffer_bytes;
+        int pass_count = 0;
+};
+
+
+long progressive_renderer::total_samples() const {
+    long total = 0;
+    for (auto n : count)
+        total += n;
+    return total;
+}
+
+
+void progressive_renderer::render(
+    double seconds, const std::function<color(int, int)>& sample, int pass_spp,
+    int max_samples_per_pixel, tile_profiler* profiler, thread_pool& pool
+) {
+    auto deadline = clock::now() + std::chrono::duration_cast<clock::duration>(
+        std::chrono::duration<double>(seconds));
+    pass_spp = std::max(pass_spp, 1);
+
+    auto across = (width + tile_size - 1) / tile_size;
+    auto down = (height + tile_size - 1) / tile_size;
+    auto tiles = static_cast<size_t>(across) * down;
+    std::vector<double> error(tiles);
+    std::vector<double> budget(tiles);
+
+    while (clock::now() < deadline) {
+        // Spread this pass's samples over the tiles by their error. A tile never drops
+        // below a tenth of the average, so none is starved on a lucky low estimate.
+        pool.parallel_for(0, tiles, 1, [&](size_t b, size_t e) {
+            for (auto t = b; t < e; t++) {
+                auto x0 = static_cast<int>(t % across) * tile_size;
+                auto y0 = static_cast<int>(t / across) * tile_size;
+                auto x1 = std::min(x0 + tile_size, width), y1 = std::min(y0 + tile_size, height);
+                double total = 0;
+                for (int j = y0; j < y1; j++)
+                    for (int i = x0; i < x1; i++)
+                        total += pixel_error(index(i, j));
+                error[t] = total / ((x1 - x0) * (y1 - y0));
+            }
+        });
+
+        double mean_error = 0;
+        for (auto e : error)
+            mean_error += e / tiles;
+        for (size_t t = 0; t < tiles; t++)
+            budget[t] = pass_spp * (mean_error > 0 ? std::max(error[t] / mean_error, 0.1) : 1.0);
+
+        bool converged = max_samples_per_pixel > 0;
+        pool.parallel_for(0, tiles, 1, [&](size_t b, size_t e) {
+            for (auto t = b; t < e && clock::now() < deadline; t++) {
+                auto start = profiler ? profiler->now() : 0.0;
+                auto x0 = static_cast<int>(t % across) * tile_size;
+                auto y0 = static_cast<int>(t / across) * tile_size;
+                auto x1 = std::min(x0 + tile_size, width), y1 = std::min(y0 + tile_size, height);
+
+                // Fractional budgets round up or down at random, so they hold on average.
+                long taken = 0;
+                for (int j = y0; j < y1; j++) {
+                    for (int i = x0; i < x1; i++) {
+                        if (clock::now() >= deadline)
+                            break;
+                        auto k = index(i, j);
+                        auto n = static_cast<int>(budget[t] + random_double());
+                        if (max_samples_per_pixel > 0)
+                            n = std::min(n, max_samples_per_pixel - count[k]);
+                        for (int s = 0; s < n; s++) {
+                            auto c = sample(i, j);
+                            auto y = luminance(c);
+                            sum[k] += c;
+                            sum_squares[k] += y * y;
+                        }
+                        count[k] += std::max(n, 0);
+                        taken += std::max(n, 0);
+                    }
+                }
+
+                if (profiler)
+                    profiler->record(static_cast<int>(t % across),
+                                     down - 1 - static_cast<int>(t / across),
+                                     x0, height - y1, x1 - x0, y1 - y0, taken,
+                                     start, profiler->now());
+            }
+        });
+        pass_count++;
+
+        if (after_pass && !after_pass())
+            break;
+
+        if (converged) {
+            for (auto n : count)
+                converged = converged && n >= max_samples_per_pixel;
+            if (converged)
+                break;
+        }
+    }
+}
+
+
+#endif
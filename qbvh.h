@@ -0,0 +1,806 @@
+#ifndef QBVH_H
+#define QBVH_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "hittable_list.h"
+#include "memory_stats.h"
+#include "numa.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+
+// Compressed 4-wide BVH.
+//
+// Nodes are stored flat in one vector, one 64-byte cache line each. A node keeps its own
+// bounds as a float origin plus a power-of-two step per axis, and the bounds of its four
+// children as 8-bit offsets in that grid, rounded outwards so they stay conservative.
+// Children are addressed by 32-bit indices, so the node and primitive arrays can be
+// written to and read from disk as-is.
+
+struct alignas(64) qbvh_node {
+    float origin[3];          // lower corner of the node bounds
+    int8_t exponent[3];       // quantization step on each axis is 2^exponent
+    uint8_t child_count;
+    uint8_t qlo[3][4];        // quantized child bounds, [axis][child]
+    uint8_t qhi[3][4];
+    uint32_t child[4];        // inner child: node index, leaf child: first primitive ref
+    uint8_t prim_count[4];    // 0 for inner children
+};
+
+static_assert(sizeof(qbvh_node) == 64, "qbvh_node must fit one cache line");
+
+
+// The tree alone, over primitives known only by index. Building asks for each primitive's
+// bounds; traversal hands leaf primitives to a callback by their position in prim_refs.
+class qbvh_tree {
+    public:
+        static const int max_leaf_size = 4;
+
+        // Builds over primitives [0, count), bounds(i) giving the aabb of primitive i.
+        // With a pool, large trees build their lower levels in parallel.
+        template<class Bounds>
+        void build(uint32_t count, const Bounds& bounds, thread_pool* pool = nullptr);
+
+        // Recomputes every node's bounds after primitives moved, keeping the topology.
+        // Leaves refer to primitive prim_refs[k], or to k itself once prim_refs is dropped.
+        template<class Bounds>
+        void refit(const Bounds& bounds);
+
+        bool empty() const { return nodes.empty(); }
+
+        // Bounds of a whole node, recovered from its quantization grid.
+        aabb node_box(uint32_t index) const;
+
+        // Bounds of child c of a node, as the traversal sees them.
+        aabb child_box(uint32_t index, int c) const;
+
+        // Closest-hit traversal. test(ref, t_max) intersects primitive prim_refs[ref] and
+        // returns the new closest distance when it is hit, or t_max otherwise.
+        template<class Test>
+        void closest(const ray& r, double t_min, double t_max, const Test& test) const;
+
+        // Any-hit traversal: stops at the first primitive for which test(ref) is true.
+        template<class Test>
+        bool any(const ray& r, double t_min, double t_max, const Test& test) const;
+
+    public:
+        std::vector<qbvh_node> nodes;
+        std::vector<uint32_t> prim_refs;   // leaf primitive indices
+
+    private:
+        // A primitive during the build: twice its centroid (which sorts the same) kept next
+        // to its index, so the splits stream through memory.
+        struct build_ref {
+            float centroid[3];
+            uint32_t index;
+        };
+
+        // A subtree left for later by the top-level pass of a parallel build.
+        struct deferred {
+            uint32_t node;
+            int slot;
+            size_t begin, end;
+        };
+
+        template<class Bounds>
+        static uint32_t build_node(
+            std::vector<qbvh_node>& out_nodes, std::vector<uint32_t>& out_refs,
+            std::vector<build_ref>& refs, size_t begin, size_t end, const Bounds& bounds,
+            std::vector<deferred>* defer, size_t defer_size, aabb& box);
+
+        static void quantize(qbvh_node& node, const aabb child_box[4], int count);
+
+        // Decodes the four child boxes of a node and slab-tests them against the ray.
+        // Returns a bit mask of the children that are hit, with their entry distances.
+        static int intersect_children(
+            const qbvh_node& node, const float org[3], const float inv_dir[3],
+            float t_min, float t_max, float t_near[4]);
+};
+
+
+class qbvh : public hittable {
+    public:
+        qbvh() {}
+        qbvh(const hittable_list& list) : objects(list.objects) { build(); }
+
+        // Loads a tree previously written by save() for the same list. If the file is
+        // missing or does not match the list, the tree is rebuilt.
+        qbvh(const hittable_list& list, const char* filename) : objects(list.objects) {
+            if (!load(filename)) {
+                std::cerr << "ERROR: Could not load BVH file '" << filename << "', rebuilding.\n";
+                build();
+            }
+        }
+
+        bool save(const char* filename) const;
+
+        // Updates the tree after objects moved, far cheaper than building it again. Falls
+        // back to a rebuild if an object gained or lost its bounding box.
+        void refit();
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        virtual bool bounding_box(aabb& output_box) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool closest_hit(const ray& r, double t_min, double t_max, hit_summary& out) const override;
+
+        // Boxes that together hold every object: the children of the top levels of the
+        // tree, opened widest first while there are fewer than max_boxes. False when
+        // some object has no bounding box.
+        bool top_boxes(std::vector<aabb>& out, size_t max_boxes) const;
+
+    public:
+        qbvh_tree tree;                    // prim_refs index into objects
+        std::vector<uint32_t> unbounded;   // objects without a bounding box, tested linearly
+
+    private:
+        void build();
+        bool load(const char* filename);
+        void resolve();
+
+        std::vector<shared_ptr<hittable>> objects;
+        std::vector<const hittable*> prims;  // objects in prim_refs order, for the hot loop
+        aabb root_box;
+        memory_charge tree_bytes{memory_tag::acceleration};
+};
+
+
+aabb qbvh_tree::child_box(uint32_t index, int c) const {
+    const auto& n = nodes[index];
+    point3 lo, hi;
+    for (int a = 0; a < 3; a++) {
+        auto step = ldexpf(1.0f, n.exponent[a]);
+        lo[a] = n.origin[a] + n.qlo[a][c] * step;
+        hi[a] = n.origin[a] + n.qhi[a][c] * step;
+    }
+    return aabb(lo, hi);
+}
+
+
+aabb qbvh_tree::node_box(uint32_t index) const {
+    const auto& n = nodes[index];
+    point3 lo, hi;
+    for (int a = 0; a < 3; a++) {
+        auto step = ldexpf(1.0f, n.exponent[a]);
+        auto qmin = 255, qmax = 0;
+        for (int c = 0; c < n.child_count; c++) {
+            qmin = std::min<int>(qmin, n.qlo[a][c]);
+            qmax = std::max<int>(qmax, n.qhi[a][c]);
+        }
+        lo[a] = n.origin[a] + qmin * step;
+        hi[a] = n.origin[a] + qmax * step;
+    }
+    return aabb(lo, hi);
+}
+
+
+template<class Bounds>
+void qbvh_tree::build(uint32_t count, const Bounds& bounds, thread_pool* pool) {
+    nodes.clear();
+    prim_refs.clear();
+    if (count == 0)
+        return;
+
+    const size_t parallel_threshold = 1 << 16;
+    auto parallel = pool && pool->size() > 1 && count >= parallel_threshold;
+
+    std::vector<build_ref> refs(count);
+    auto prepare = [&](size_t b, size_t e) {
+        for (auto i = b; i < e; i++) {
+            aabb box = bounds(static_cast<uint32_t>(i));
+            for (int a = 0; a < 3; a++)
+                refs[i].centroid[a] = static_cast<float>(box.min()[a] + box.max()[a]);
+            refs[i].index = static_cast<uint32_t>(i);
+        }
+    };
+    if (parallel)
+        pool->parallel_for(0, count, parallel_threshold, prepare);
+    else
+        prepare(0, count);
+
+    if (!parallel) {
+        aabb box;
+        build_node(nodes, prim_refs, refs, 0, count, bounds, nullptr, 0, box);
+        return;
+    }
+
+    // Build the top levels here, leaving subtrees of at most defer_size primitives as
+    // placeholders, then build those independently and splice them in.
+    auto defer_size = std::max<size_t>(count / (8 * pool->size()), parallel_threshold / 4);
+    std::vector<deferred> pending;
+    aabb box;
+    build_node(nodes, prim_refs, refs, 0, count, bounds, &pending, defer_size, box);
+
+    std::vector<std::vector<qbvh_node>> sub_nodes(pending.size());
+    std::vector<std::vector<uint32_t>> sub_refs(pending.size());
+    pool->parallel_for(0, pending.size(), 1, [&](size_t b, size_t e) {
+        for (auto i = b; i < e; i++) {
+            aabb box;
+            build_node(sub_nodes[i], sub_refs[i], refs, pending[i].begin, pending[i].end,
+                       bounds, nullptr, 0, box);
+        }
+    });
+
+    for (size_t i = 0; i < pending.size(); i++) {
+        auto node_offset = static_cast<uint32_t>(nodes.size());
+        auto ref_offset = static_cast<uint32_t>(prim_refs.size());
+        for (auto node : sub_nodes[i]) {
+            for (int c = 0; c < node.child_count; c++)
+                node.child[c] += node.prim_count[c] ? ref_offset : node_offset;
+            nodes.push_back(node);
+        }
+        prim_refs.insert(prim_refs.end(), sub_refs[i].begin(), sub_refs[i].end());
+        nodes[pending[i].node].child[pending[i].slot] = node_offset;
+
+        std::vector<qbvh_node>().swap(sub_nodes[i]);
+        std::vector<uint32_t>().swap(sub_refs[i]);
+    }
+}
+
+
+template<class Bounds>
+void qbvh_tree::refit(const Bounds& bounds) {
+    // Children always come after their parent, so one backwards sweep sees every child
+    // before the node that holds it.
+    std::vector<aabb> boxes(nodes.size());
+    for (auto n = nodes.size(); n-- > 0;) {
+        auto& node = nodes[n];
+        aabb child_box[4];
+        for (int c = 0; c < node.child_count; c++) {
+            if (node.prim_count[c] == 0) {
+                child_box[c] = boxes[node.child[c]];
+                continue;
+            }
+            for (uint32_t k = node.child[c]; k < node.child[c] + node.prim_count[c]; k++) {
+                auto box = bounds(prim_refs.empty() ? k : prim_refs[k]);
+                child_box[c] = k == node.child[c] ? box : surrounding_box(child_box[c], box);
+            }
+        }
+
+        quantize(node, child_box, node.child_count);
+        boxes[n] = child_box[0];
+        for (int c = 1; c < node.child_count; c++)
+            boxes[n] = surrounding_box(boxes[n], child_box[c]);
+    }
+}
+
+
+template<class Bounds>
+uint32_t qbvh_tree::build_node(
+    std::vector<qbvh_node>& out_nodes, std::vector<uint32_t>& out_refs,
+    std::vector<build_ref>& refs, size_t begin, size_t end, const Bounds& bounds,
+    std::vector<deferred>* defer, size_t defer_size, aabb& box
+) {
+    auto node_index = static_cast<uint32_t>(out_nodes.size());
+    out_nodes.emplace_back();
+
+
+    // Split the range into up to four clusters by repeatedly halving the largest one
+    // along its longest centroid axis.
+    size_t split[5] = {begin, end};
+    int count = 1;
+    while (count < 4) {
+        int largest = -1;
+        for (int c = 0; c < count; c++) {
+            auto size = split[c+1] - split[c];
+            if (size > max_leaf_size && (largest < 0 || size > split[largest+1] - split[largest]))
+                largest = c;
+        }
+        if (largest < 0)
+            break;
+
+        auto b = split[largest], e = split[largest+1];
+        float lo[3], hi[3];
+        for (int a = 0; a < 3; a++)
+            lo[a] = hi[a] = refs[b].centroid[a];
+        for (auto i = b+1; i < e; i++) {
+            for (int a = 0; a < 3; a++) {
+                lo[a] = std::min(lo[a], refs[i].centroid[a]);
+                hi[a] = std::max(hi[a], refs[i].centroid[a]);
+            }
+        }
+        int axis = 0;
+        for (int a = 1; a < 3; a++)
+            if (hi[a] - lo[a] > hi[axis] - lo[axis])
+                axis = a;
+        auto mid = b + (e - b)/2;
+        std::nth_element(refs.begin() + b, refs.begin() + mid, refs.begin() + e,
+            [axis](const build_ref& x, const build_ref& y) {
+                return x.centroid[axis] < y.centroid[axis];
+            });
+
+        for (int c = count; c > largest; c--)
+            split[c+1] = split[c];
+        split[largest+1] = mid;
+        count++;
+    }
+
+    aabb child_box[4];
+    uint32_t child[4];
+    uint8_t prim_count[4];
+
+    for (int c = 0; c < count; c++) {
+        auto b = split[c], e = split[c+1];
+
+        // Inner children report their bounds from below; the rest are gathered here.
+        prim_count[c] = 0;
+        if (e - b <= max_leaf_size || (defer && e - b <= defer_size)) {
+            child_box[c] = bounds(refs[b].index);
+            for (auto i = b+1; i < e; i++)
+                child_box[c] = surrounding_box(child_box[c], bounds(refs[i].index));
+        }
+
+        if (e - b <= max_leaf_size) {
+            child[c] = static_cast<uint32_t>(out_refs.size());
+            prim_count[c] = static_cast<uint8_t>(e - b);
+            for (auto i = b; i < e; i++)
+                out_refs.push_back(refs[i].index);
+        } else if (defer && e - b <= defer_size) {
+            child[c] = 0;
+            defer->push_back({node_index, c, b, e});
+        } else {
+            child[c] = build_node(
+                out_nodes, out_refs, refs, b, e, bounds, defer, defer_size, child_box[c]);
+        }
+    }
+
+    box = child_box[0];
+    for (int c = 1; c < count; c++)
+        box = surrounding_box(box, child_box[c]);
+
+    auto& node = out_nodes[node_index];
+    quantize(node, child_box, count);
+    for (int c = 0; c < 4; c++) {
+        node.child[c] = c < count ? child[c] : 0;
+        node.prim_count[c] = c < count ? prim_count[c] : 0;
+    }
+
+    return node_index;
+}
+
+
+void qbvh_tree::quantize(qbvh_node& node, const aabb child_box[4], int count) {
+    aabb box = child_box[0];
+    for (int c = 1; c < count; c++)
+        box = surrounding_box(box, child_box[c]);
+
+    // Quantize relative to this node: origin rounded down to float, then the smallest
+    // power-of-two step that lets 255 steps cover the extent.
+    node.child_count = static_cast<uint8_t>(count);
+
+    for (int a = 0; a < 3; a++) {
+        auto origin = static_cast<float>(box.min()[a]);
+        if (origin > box.min()[a])
+            origin = nextafterf(origin, -std::numeric_limits<float>::infinity());
+
+        auto e = static_cast<int>(ceil(log2(fmax(box.max()[a] - origin, 1e-30) / 255.0)));
+        e = static_cast<int>(clamp(e, -100, 100));
+        while (e < 100 && origin + 255 * ldexpf(1.0f, e) < box.max()[a])
+            e++;
+        auto step = ldexpf(1.0f, e);
+
+        node.origin[a] = origin;
+        node.exponent[a] = static_cast<int8_t>(e);
+
+        for (int c = 0; c < 4; c++) {
+            if (c >= count) {
+                // Empty lanes are masked out by child_count during traversal.
+                node.qlo[a][c] = 255;
+                node.qhi[a][c] = 0;
+                continue;
+            }
+            auto lo = static_cast<int>(clamp(floor((child_box[c].min()[a] - origin) / step), 0, 255));
+            auto hi = static_cast<int>(clamp(ceil((child_box[c].max()[a] - origin) / step), 0, 255));
+            while (lo > 0 && origin + lo * step > child_box[c].min()[a])
+                lo--;
+            while (hi < 255 && origin + hi * step < child_box[c].max()[a])
+                hi++;
+            node.qlo[a][c] = static_cast<uint8_t>(lo);
+            node.qhi[a][c] = static_cast<uint8_t>(hi);
+        }
+    }
+}
+
+
+int qbvh_tree::intersect_children(
+    const qbvh_node& node, const float org[3], const float inv_dir[3],
+    float t_min, float t_max, float t_near[4]
+) {
+#if defined(__SSE2__)
+    auto t0 = _mm_set1_ps(t_min);
+    auto t1 = _mm_set1_ps(t_max);
+
+    for (int a = 0; a < 3; a++) {
+        auto zero = _mm_setzero_si128();
+        int qlo_bits, qhi_bits;
+        std::copy(node.qlo[a], node.qlo[a] + 4, reinterpret_cast<uint8_t*>(&qlo_bits));
+        std::copy(node.qhi[a], node.qhi[a] + 4, reinterpret_cast<uint8_t*>(&qhi_bits));
+        auto qlo = _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+            _mm_unpacklo_epi8(_mm_cvtsi32_si128(qlo_bits), zero), zero));
+        auto qhi = _mm_cvtepi32_ps(_mm_unpacklo_epi16(
+            _mm_unpacklo_epi8(_mm_cvtsi32_si128(qhi_bits), zero), zero));
+
+        auto step = _mm_set1_ps(ldexpf(1.0f, node.exponent[a]));
+        auto base = _mm_set1_ps(node.origin[a] - org[a]);
+        auto inv = _mm_set1_ps(inv_dir[a]);
+
+        auto ta = _mm_mul_ps(_mm_add_ps(base, _mm_mul_ps(qlo, step)), inv);
+        auto tb = _mm_mul_ps(_mm_add_ps(base, _mm_mul_ps(qhi, step)), inv);
+        t0 = _mm_max_ps(t0, _mm_min_ps(ta, tb));
+        t1 = _mm_min_ps(t1, _mm_max_ps(ta, tb));
+    }
+
+    // Widen the exit distance to absorb the float rounding of the ray origin.
+    t1 = _mm_mul_ps(t1, _mm_set1_ps(1.00001f));
+    _mm_storeu_ps(t_near, t0);
+    int mask = _mm_movemask_ps(_mm_cmple_ps(t0, t1));
+#else
+    float t_far[4];
+    for (int c = 0; c < 4; c++) {
+        t_near[c] = t_min;
+        t_far[c] = t_max;
+    }
+
+    for (int a = 0; a < 3; a++) {
+        auto step = ldexpf(1.0f, node.exponent[a]);
+        auto base = node.origin[a] - org[a];
+        for (int c = 0; c < 4; c++) {
+            auto ta = (base + node.qlo[a][c] * step) * inv_dir[a];
+            auto tb = (base + node.qhi[a][c] * step) * inv_dir[a];
+            t_near[c] = std::max(t_near[c], std::min(ta, tb));
+            t_far[c] = std::min(t_far[c], std::max(ta, tb));
+        }
+    }
+
+    int mask = 0;
+    for (int c = 0; c < 4; c++)
+        if (t_near[c] <= t_far[c] * 1.00001f)
+            mask |= 1 << c;
+#endif
+
+    return mask & ((1 << node.child_count) - 1);
+}
+
+
+template<class Test>
+void qbvh_tree::closest(const ray& r, double t_min, double t_max, const Test& test) const {
+    if (nodes.empty())
+        return;
+
+    float org[3], inv_dir[3];
+    for (int a = 0; a < 3; a++) {
+        org[a] = static_cast<float>(r.origin()[a]);
+        inv_dir[a] = static_cast<float>(1.0 / r.direction()[a]);
+    }
+
+    struct entry { uint32_t node; float t; };
+    entry stack[64];
+    int top = 0;
+    stack[top++] = {0, static_cast<float>(t_min)};
+
+    while (top > 0) {
+        auto e = stack[--top];
+        if (e.t > t_max)
+            continue;
+
+        const auto& node = nodes[e.node];
+        float t_near[4];
+        int mask = intersect_children(
+            node, org, inv_dir, static_cast<float>(t_min), static_cast<float>(t_max), t_near);
+
+        // Visit leaves right away, queue inner children so the nearest is popped first.
+        entry queued[4];
+        int queued_count = 0;
+        for (int c = 0; c < 4; c++) {
+            if (!(mask & (1 << c)))
+                continue;
+            if (node.prim_count[c] == 0) {
+                queued[queued_count++] = {node.child[c], t_near[c]};
+                continue;
+            }
+            for (uint32_t i = node.child[c]; i < node.child[c] + node.prim_count[c]; i++)
+                t_max = test(i, t_max);
+        }
+
+        for (int i = 1; i < queued_count; i++)
+            for (int j = i; j > 0 && queued[j-1].t < queued[j].t; j--)
+                std::swap(queued[j-1], queued[j]);
+        for (int i = 0; i < queued_count; i++)
+            stack[top++] = queued[i];
+    }
+}
+
+
+template<class Test>
+bool qbvh_tree::any(const ray& r, double t_min, double t_max, const Test& test) const {
+    if (nodes.empty())
+        return false;
+
+    float org[3], inv_dir[3];
+    for (int a = 0; a < 3; a++) {
+        org[a] = static_cast<float>(r.origin()[a]);
+        inv_dir[a] = static_cast<float>(1.0 / r.direction()[a]);
+    }
+
+    // Any blocker will do, so children are visited in storage order.
+    uint32_t stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const auto& node = nodes[stack[--top]];
+        float t_near[4];
+        int mask = intersect_children(
+            node, org, inv_dir, static_cast<float>(t_min), static_cast<float>(t_max), t_near);
+
+        for (int c = 0; c < 4; c++) {
+            if (!(mask & (1 << c)))
+                continue;
+            if (node.prim_count[c] == 0) {
+                stack[top++] = node.child[c];
+                continue;
+            }
+            for (uint32_t i = node.child[c]; i < node.child[c] + node.prim_count[c]; i++)
+                if (test(i))
+                    return true;
+        }
+    }
+
+    return false;
+}
+
+
+void qbvh::build() {
+    unbounded.clear();
+
+    std::vector<aabb> boxes;
+    std::vector<uint32_t> bounded;
+    boxes.reserve(objects.size());
+
+    for (uint32_t i = 0; i < objects.size(); i++) {
+        aabb box;
+        if (objects[i]->bounding_box(box)) {
+            boxes.push_back(box);
+            bounded.push_back(i);
+        } else {
+            unbounded.push_back(i);
+        }
+    }
+
+    tree.build(static_cast<uint32_t>(boxes.size()),
+        [&boxes](uint32_t i) { return boxes[i]; }, &default_thread_pool());
+
+    // Refer to objects directly rather than to the bounded subset.
+    for (auto& ref : tree.prim_refs)
+        ref = bounded[ref];
+
+    resolve();
+}
+
+
+void qbvh::refit() {
+    std::vector<char> was_bounded(objects.size(), 1);
+    for (auto index : unbounded)
+        was_bounded[index] = 0;
+
+    std::vector<aabb> boxes(objects.size());
+    for (size_t i = 0; i < objects.size(); i++) {
+        if (objects[i]->bounding_box(boxes[i]) != static_cast<bool>(was_bounded[i])) {
+            build();
+            return;
+        }
+    }
+
+    tree.refit([&boxes](uint32_t i) { return boxes[i]; });
+    if (!tree.empty())
+        root_box = tree.node_box(0);
+}
+
+
+void qbvh::resolve() {
+    prims.clear();
+    prims.reserve(tree.prim_refs.size());
+    for (auto index : tree.prim_refs)
+        prims.push_back(objects[index].get());
+
+    if (!tree.empty())
+        root_box = tree.node_box(0);
+
+    tree_bytes.set(tree.nodes.capacity() * sizeof(qbvh_node) + tree.prim_refs.capacity() * sizeof(uint32_t)
+                   + unbounded.capacity() * sizeof(uint32_t) + prims.capacity() * sizeof(const hittable*));
+
+    // Every thread reads the tree; on a NUMA machine no node should hold all of it.
+    numa_interleave(tree.nodes.data(), tree.nodes.size() * sizeof(qbvh_node));
+    numa_interleave(prims.data(), prims.size() * sizeof(const hittable*));
+}
+
+
+// On-disk layout: header, then the node, primitive ref and unbounded arrays back to back.
+struct qbvh_file_header {
+    char magic[4];
+    uint32_t version;
+    uint32_t object_count;
+    uint32_t node_count;
+    uint32_t prim_ref_count;
+    uint32_t unbounded_count;
+};
+
+
+bool qbvh::save(const char* filename) const {
+    auto f = fopen(filename, "wb");
+    if (!f) {
+        std::cerr << "ERROR: Could not write BVH file '" << filename << "'.\n";
+        return false;
+    }
+
+    const auto& nodes = tree.nodes;
+    const auto& prim_refs = tree.prim_refs;
+
+    qbvh_file_header header = {
+        {'Q', 'B', 'V', 'H'}, 1,
+        static_cast<uint32_t>(objects.size()),
+        static_cast<uint32_t>(nodes.size()),
+        static_cast<uint32_t>(prim_refs.size()),
+        static_cast<uint32_t>(unbounded.size())
+    };
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && fwrite(nodes.data(), sizeof(qbvh_node), nodes.size(), f) == nodes.size()
+        && fwrite(prim_refs.data(), sizeof(uint32_t), prim_refs.size(), f) == prim_refs.size()
+        && fwrite(unbounded.data(), sizeof(uint32_t), unbounded.size(), f) == unbounded.size();
+
+    fclose(f);
+    return ok;
+}
+
+
+bool qbvh::load(const char* filename) {
+    auto f = fopen(filename, "rb");
+    if (!f)
+        return false;
+
+    auto& nodes = tree.nodes;
+    auto& prim_refs = tree.prim_refs;
+
+    qbvh_file_header header;
+    bool ok = fread(&header, sizeof(header), 1, f) == 1
+        && std::equal(header.magic, header.magic + 4, "QBVH")
+        && header.version == 1
+        && header.object_count == objects.size();
+
+    if (ok) {
+        nodes.resize(header.node_count);
+        prim_refs.resize(header.prim_ref_count);
+        unbounded.resize(header.unbounded_count);
+        ok = fread(nodes.data(), sizeof(qbvh_node), nodes.size(), f) == nodes.size()
+            && fread(prim_refs.data(), sizeof(uint32_t), prim_refs.size(), f) == prim_refs.size()
+            && fread(unbounded.data(), sizeof(uint32_t), unbounded.size(), f) == unbounded.size();
+    }
+    fclose(f);
+
+    if (ok) {
+        for (auto index : prim_refs)
+            ok = ok && index < objects.size();
+        for (auto index : unbounded)
+            ok = ok && index < objects.size();
+    }
+
+    if (!ok) {
+        nodes.clear();
+        prim_refs.clear();
+        unbounded.clear();
+        return false;
+    }
+
+    resolve();
+    return true;
+}
+
+
+bool qbvh::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    hit_record temp_rec;
+    auto hit_anything = false;
+    auto closest_so_far = t_max;
+
+    for (auto index : unbounded) {
+        if (objects[index]->hit(r, t_min, closest_so_far, temp_rec)) {
+            hit_anything = true;
+            closest_so_far = temp_rec.t;
+            rec = temp_rec;
+        }
+    }
+
+    tree.closest(r, t_min, closest_so_far, [&](uint32_t i, double t_max) {
+        if (!prims[i]->hit(r, t_min, t_max, temp_rec))
+            return t_max;
+        hit_anything = true;
+        rec = temp_rec;
+        return temp_rec.t;
+    });
+
+    return hit_anything;
+}
+
+
+bool qbvh::closest_hit(const ray& r, double t_min, double t_max, hit_summary& out) const {
+    auto hit_anything = false;
+    for (auto index : unbounded) {
+        if (objects[index]->closest_hit(r, t_min, t_max, out)) {
+            hit_anything = true;
+            t_max = out.t;
+        }
+    }
+
+    tree.closest(r, t_min, t_max, [&](uint32_t i, double t_max) {
+        if (!prims[i]->closest_hit(r, t_min, t_max, out))
+            return t_max;
+        hit_anything = true;
+        return out.t;
+    });
+
+    return hit_anything;
+}
+
+
+bool qbvh::occluded(const ray& r, double t_min, double t_max) const {
+    for (auto index : unbounded)
+        if (objects[index]->occluded(r, t_min, t_max))
+            return true;
+
+    return tree.any(r, t_min, t_max, [&](uint32_t i) {
+        return prims[i]->occluded(r, t_min, t_max);
+    });
+}
+
+
+bool qbvh::top_boxes(std::vector<aabb>& out, size_t max_boxes) const {
+    out.clear();
+    if (!unbounded.empty())
+        return false;
+    if (tree.empty())
+        return true;
+
+    // node: an inner node still to open, -1 for a leaf child, -2 once opened.
+    struct entry { aabb box; int64_t node; };
+    std::vector<entry> open{{tree.node_box(0), 0}};
+    for (size_t next = 0; next < open.size(); next++) {
+        if (open[next].node < 0)
+            continue;
+        auto index = static_cast<uint32_t>(open[next].node);
+        const auto& n = tree.nodes[index];
+        if (open.size() - 1 + n.child_count > max_boxes)
+            break;
+        open[next].node = -2;   // replaced by its children
+        for (int c = 0; c < n.child_count; c++)
+            open.push_back({tree.child_box(index, c), n.prim_count[c] ? -1 : static_cast<int64_t>(n.child[c])});
+    }
+    for (const auto& e : open)
+        if (e.node != -2)
+            out.push_back(e.box);
+    return true;
+}
+
+
+bool qbvh::bounding_box(aabb& output_box) const {
+    if (tree.empty() || !unbounded.empty())
+        return false;
+    output_box = root_box;
+    return true;
+}
+
+
+#endif
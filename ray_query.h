@@ -0,0 +1,154 @@
+#ifndef RAY_QUERY_H
+#define RAY_QUERY_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "thread_pool.h"
+
+#include <cstdint>
+#include <vector>
+
+
+// Consultas de raios em lote, sem sombreamento.
+//
+// Para ferramentas de visibilidade e colisao que so querem saber o que cada raio atinge.
+// closest() devolve, para cada raio, o acerto mais proximo, preenchendo so os campos
+// pedidos (distancia, ponto, normal, uv, objeto, material) em vetores separados; any()
+// so diz se algo bloqueia cada segmento, e para no primeiro acerto. Os raios sao
+// divididos em blocos que as threads do pool processam em paralelo; dentro da qbvh cada
+// no testa os quatro filhos de uma vez (SSE). A cena e qualquer hittable, normalmente a
+// qbvh.
+//
+// Sem normal nem uv, closest() usa hittable::closest_hit, que so devolve a distancia, o
+// objeto e um ponteiro cru para o material: nenhum shared_ptr e copiado, e as threads nao
+// disputam o contador de referencias do material. Pedir normal ou uv passa pelo hit()
+// completo, que copia o shared_ptr do material a cada acerto; com muitos raios batendo no
+// mesmo material, essa linha de cache vira disputa entre as threads.
+
+enum query_field : unsigned {
+    query_distance = 1 << 0,
+    query_point    = 1 << 1,
+    query_normal   = 1 << 2,   // facing the ray, as in hit_record; needs the full hit()
+    query_uv       = 1 << 3,   // needs the full hit()
+    query_object   = 1 << 4,   // hit_record::object
+    query_material = 1 << 5,
+    query_all      = (1 << 6) - 1
+};
+
+
+// One entry per ray in `hit` and in every requested field; the other fields stay empty.
+// Fields of rays that miss are left at t = infinity, zero vectors and null pointers.
+struct query_results {
+    std::vector<uint8_t> hit;
+    std::vector<double> distance;
+    std::vector<point3> point;
+    std::vector<vec3> normal;
+    std::vector<double> u, v;
+    std::vector<const void*> object;
+    std::vector<const material*> materials;
+};
+
+
+class ray_query {
+    public:
+        static const size_t block_size = 256;   // rays per task
+
+        explicit ray_query(const hittable& s, thread_pool& p = default_thread_pool())
+            : scene(s), pool(p) {}
+
+        // Closest hit in [t_min, t_max] for rays[0..count), or in [t_min, t_max[i]] when
+        // per-ray limits are given. `fields` is a mask of query_field.
+        void closest(
+            const ray* rays, size_t count, double t_min, double t_max, unsigned fields,
+            query_results& out, const double* ray_t_max = nullptr) const;
+
+        // occluded[i] = 1 if anything lies on ray i between t_min and its t_max.
+        void any(
+            const ray* rays, size_t count, double t_min, double t_max, uint8_t* occluded,
+            const double* ray_t_max = nullptr) const;
+
+        void closest(const std::vector<ray>& rays, double t_min, double t_max, unsigned fields,
+                     query_results& out) const {
+            closest(rays.data(), rays.size(), t_min, t_max, fields, out);
+        }
+
+        std::vector<uint8_t> any(const std::vector<ray>& rays, double t_min, double t_max) const {
+            std::vector<uint8_t> occluded(rays.size());
+            any(rays.data(), rays.size(), t_min, t_max, occluded.data());
+            return occluded;
+        }
+
+    private:
+        // Copies the requested fields of rec into entry i of out.
+        static void store(const hit_record& rec, unsigned fields, size_t i, query_results& out);
+
+    private:
+        const hittable& scene;
+        thread_pool& pool;
+};
+
+
+void ray_query::store(const hit_record& rec, unsigned fields, size_t i, query_results& out) {
+    if (fields & query_distance) out.distance[i] = rec.t;
+    if (fields & query_point)    out.point[i] = rec.p;
+    if (fields & query_normal)   out.normal[i] = rec.normal;
+    if (fields & query_uv)       { out.u[i] = rec.u; out.v[i] = rec.v; }
+    if (fields & query_object)   out.object[i] = rec.object;
+    if (fields & query_material) out.materials[i] = rec.mat_ptr.get();
+}
+
+
+void ray_query::closest(
+    const ray* rays, size_t count, double t_min, double t_max, unsigned fields,
+    query_results& out, const double* ray_t_max
+) const {
+    out.hit.assign(count, 0);
+    out.distance.assign(fields & query_distance ? count : 0, infinity);
+    out.point.assign(fields & query_point ? count : 0, point3(0, 0, 0));
+    out.normal.assign(fields & query_normal ? count : 0, vec3(0, 0, 0));
+    out.u.assign(fields & query_uv ? count : 0, 0.0);
+    out.v.assign(fields & query_uv ? count : 0, 0.0);
+    out.object.assign(fields & query_object ? count : 0, nullptr);
+    out.materials.assign(fields & query_material ? count : 0, nullptr);
+
+    if (fields & (query_normal | query_uv)) {
+        pool.parallel_for(0, count, block_size, [&](size_t b, size_t e) {
+            hit_record rec;
+            for (auto i = b; i < e; i++) {
+                if (scene.hit(rays[i], t_min, ray_t_max ? ray_t_max[i] : t_max, rec)) {
+                    out.hit[i] = 1;
+                    store(rec, fields, i, out);
+                }
+            }
+        });
+        return;
+    }
+
+    pool.parallel_for(0, count, block_size, [&](size_t b, size_t e) {
+        hit_summary found;
+        for (auto i = b; i < e; i++) {
+            if (!scene.closest_hit(rays[i], t_min, ray_t_max ? ray_t_max[i] : t_max, found))
+                continue;
+            out.hit[i] = 1;
+            if (fields & query_distance) out.distance[i] = found.t;
+            if (fields & query_point)    out.point[i] = rays[i].at(found.t);
+            if (fields & query_object)   out.object[i] = found.object;
+            if (fields & query_material) out.materials[i] = found.mat;
+        }
+    });
+}
+
+
+void ray_query::any(
+    const ray* rays, size_t count, double t_min, double t_max, uint8_t* occluded,
+    const double* ray_t_max
+) const {
+    pool.parallel_for(0, count, block_size, [&](size_t b, size_t e) {
+        for (auto i = b; i < e; i++)
+            occluded[i] = scene.occluded(rays[i], t_min, ray_t_max ? ray_t_max[i] : t_max);
+    });
+}
+
+
+#endif
@@ -0,0 +1,334 @@
+#ifndef RENDER_SERVER_H
+#define RENDER_SERVER_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "environment.h"
+#include "hittable_list.h"
+#include "integrator.h"
+#include "material_table.h"
+#include "progressive.h"
+#include "qbvh.h"
+#include "texture_loader.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <cerrno>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+
+// Servidor de renderizacao.
+//
+// Fica escutando num socket Unix local e atende um pedido por linha:
+//
+//     render scene=marble width=400 height=266 spp=64 from=13,2,3 at=0,0,0
+//     quit
+//
+// (chaves opcionais: depth, vfov, aperture, focus, seconds; width e height vao de 2 a
+// max_side, e a imagem tem no maximo max_pixels pixels). A cena de cada nome e montada
+// uma vez, com a sua qbvh e material_table, e fica guardada para os proximos pedidos; as
+// texturas vem do texture_loader padrao, que tambem fica com elas. A resposta e
+// transmitida a cada passada progressiva:
+//
+//     frame <passada> <amostras por pixel> <bytes>\n<PPM binario>
+//     ...
+//     done <segundos>\n            ou    error <mensagem>\n
+
+struct render_job {
+    // Limits that keep one request from exhausting the memory of the shared server.
+    static const int max_side = 16384;
+    static constexpr size_t max_pixels = size_t(1) << 23;   // a little over 3840x2160
+
+    std::string scene;
+    int width = 400, height = 266;
+    int samples_per_pixel = 64;
+    int max_depth = 50;
+    point3 lookfrom = point3(13, 2, 3);
+    point3 lookat = point3(0, 0, 0);
+    double vfov = 20, aperture = 0.1, focus = 10;
+    double seconds = 1e6;
+
+    // Parses the key=value words after "render"; returns false on a malformed one.
+    bool parse(std::istringstream& words, std::string& error);
+};
+
+
+class render_server {
+    public:
+        using scene_builder = std::function<hittable_list(hittable_list& lights)>;
+
+        void add_scene(const std::string& name, scene_builder build) { builders[name] = build; }
+
+        // Serves connections one at a time until a "quit" request. Returns false if the
+        // socket could not be opened.
+        bool serve(const char* socket_path);
+
+    private:
+        struct scene_entry {
+            hittable_list world, lights;
+            environment env;
+            std::unique_ptr<qbvh> bvh;
+            std::unique_ptr<material_table> materials;
+        };
+
+        scene_entry* scene(const std::string& name);
+        bool handle(int fd);   // false after "quit"
+        bool render(int fd, const render_job& job, std::string& error);
+
+        static bool send_all(int fd, const void* data, size_t size);
+        static bool send_line(int fd, const std::string& line) {
+            return send_all(fd, line.data(), line.size());
+        }
+
+    private:
+        std::map<std::string, scene_builder> builders;
+        std::map<std::string, std::unique_ptr<scene_entry>> scenes;
+};
+
+
+bool render_job::parse(std::istringstream& words, std::string& error) {
+    std::string word;
+    while (words >> word) {
+        auto eq = word.find('=');
+        if (eq == std::string::npos) {
+            error = "expected key=value, got '" + word + "'";
+            return false;
+        }
+        auto key = word.substr(0, eq);
+        std::istringstream value(word.substr(eq + 1));
+
+        auto read_point = [&value](point3& p) {
+            char comma1, comma2;
+            return static_cast<bool>(value >> p[0] >> comma1 >> p[1] >> comma2 >> p[2])
+                && comma1 == ',' && comma2 == ',';
+        };
+
+        bool ok;
+        if (key == "scene")            ok = static_cast<bool>(value >> scene);
+        else if (key == "width")       ok = static_cast<bool>(value >> width) && width > 1 && width <= max_side;
+        else if (key == "height")      ok = static_cast<bool>(value >> height) && height > 1 && height <= max_side;
+        else if (key == "spp")         ok = static_cast<bool>(value >> samples_per_pixel) && samples_per_pixel > 0;
+        else if (key == "depth")       ok = static_cast<bool>(value >> max_depth) && max_depth > 0;
+        else if (key == "from")        ok = read_point(lookfrom);
+        else if (key == "at")          ok = read_point(lookat);
+        else if (key == "vfov")        ok = static_cast<bool>(value >> vfov);
+        else if (key == "aperture")    ok = static_cast<bool>(value >> aperture);
+        else if (key == "focus")       ok = static_cast<bool>(value >> focus);
+        else if (key == "seconds")     ok = static_cast<bool>(value >> seconds) && seconds > 0;
+        else {
+            error = "unknown key '" + key + "'";
+            return false;
+        }
+
+        if (!ok) {
+            error = "bad value for '" + key + "'";
+            return false;
+        }
+    }
+
+    if (static_cast<size_t>(width) * static_cast<size_t>(height) > max_pixels) {
+        error = "image larger than " + std::to_string(max_pixels) + " pixels";
+        return false;
+    }
+    return true;
+}
+
+
+render_server::scene_entry* render_server::scene(const std::string& name) {
+    auto cached = scenes.find(name);
+    if (cached != scenes.end())
+        return cached->second.get();
+
+    auto builder = builders.find(name);
+    if (builder == builders.end())
+        return nullptr;
+
+    std::unique_ptr<scene_entry> entry(new scene_entry);
+    entry->world = builder->second(entry->lights);
+    default_texture_loader().wait();
+    entry->bvh.reset(new qbvh(entry->world));
+    entry->materials.reset(new material_table(entry->world));
+
+    auto result = entry.get();
+    scenes[name] = std::move(entry);
+    return result;
+}
+
+
+#if defined(_WIN32)
+
+bool render_server::serve(const char*) {
+    std::cerr << "ERROR: The render server needs Unix domain sockets.\n";
+    return false;
+}
+
+bool render_server::send_all(int, const void*, size_t) { return false; }
+
+bool render_server::handle(int) { return true; }
+
+#else
+
+bool render_server::send_all(int fd, const void* data, size_t size) {
+    auto p = static_cast<const char*>(data);
+    while (size > 0) {
+        auto sent = send(fd, p, size, MSG_NOSIGNAL);
+        if (sent <= 0)
+            return false;
+        p += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+
+bool render_server::serve(const char* socket_path) {
+    auto listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (listener < 0 || std::strlen(socket_path) >= sizeof(address.sun_path)) {
+        std::cerr << "ERROR: Could not open render server socket '" << socket_path << "'.\n";
+        if (listener >= 0)
+            close(listener);
+        return false;
+    }
+    std::strcpy(address.sun_path, socket_path);
+
+    // Only a stale socket is replaced; any other file at the path is left alone.
+    struct stat existing;
+    if (lstat(socket_path, &existing) == 0) {
+        if (!S_ISSOCK(existing.st_mode)) {
+            std::cerr << "ERROR: '" << socket_path << "' exists and is not a socket.\n";
+            close(listener);
+            return false;
+        }
+        unlink(socket_path);
+    }
+    if (bind(listener, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0
+            || listen(listener, 8) != 0) {
+        std::cerr << "ERROR: Could not open render server socket '" << socket_path << "'.\n";
+        close(listener);
+        return false;
+    }
+    std::cerr << "Listening on " << socket_path << "\n";
+
+    bool running = true, failed = false;
+    while (running) {
+        auto fd = accept(listener, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            std::cerr << "ERROR: Render server could not accept a connection (" << std::strerror(errno) << ").\n";
+            failed = true;
+            break;
+        }
+        running = handle(fd);
+        close(fd);
+    }
+
+    close(listener);
+    unlink(socket_path);
+    return !failed;
+}
+
+
+bool render_server::handle(int fd) {
+    // Requests are read a byte at a time up to each newline; they are short.
+    std::string line;
+    char c;
+    while (recv(fd, &c, 1, 0) == 1) {
+        if (c != '\n') {
+            line += c;
+            continue;
+        }
+
+        std::istringstream words(line);
+        line.clear();
+        std::string command, error;
+        words >> command;
+
+        if (command == "quit") {
+            send_line(fd, "bye\n");
+            return false;
+        }
+
+        render_job job;
+        if (command != "render")
+            error = "unknown command '" + command + "'";
+        else if (job.parse(words, error))
+            render(fd, job, error);
+
+        if (!error.empty() && !send_line(fd, "error " + error + "\n"))
+            break;
+    }
+    return true;
+}
+
+#endif
+
+
+bool render_server::render(int fd, const render_job& job, std::string& error) {
+    auto start = std::chrono::steady_clock::now();
+
+    auto entry = scene(job.scene);
+    if (!entry) {
+        error = "unknown scene '" + job.scene + "'";
+        return false;
+    }
+
+    camera cam(job.lookfrom, job.lookat, vec3(0,1,0), job.vfov,
+               double(job.width) / job.height, job.aperture, job.focus);
+    light_set scene_lights{entry->lights, entry->env};
+
+    // Each pass goes out as a binary PPM of the image so far.
+    progressive_renderer progressive(job.width, job.height);
+    std::vector<unsigned char> frame;
+    bool connected = true;
+    progressive.after_pass = [&] {
+        std::ostringstream header;
+        header << "P6\n" << job.width << ' ' << job.height << "\n255\n";
+        auto head = header.str();
+        frame.assign(head.begin(), head.end());
+        for (int j = job.height-1; j >= 0; --j)
+            for (int i = 0; i < job.width; ++i) {
+                auto c = progressive.pixel(i, j);
+                for (int k = 0; k < 3; k++)
+                    frame.push_back(static_cast<unsigned char>(256 * clamp(sqrt(c[k]), 0.0, 0.999)));
+            }
+
+        std::ostringstream line;
+        line << "frame " << progressive.passes() << ' '
+             << progressive.total_samples() / double(static_cast<size_t>(job.width) * job.height) << ' '
+             << frame.size() << '\n';
+        connected = send_line(fd, line.str()) && send_all(fd, frame.data(), frame.size());
+        return connected;
+    };
+
+    progressive.render(job.seconds, [&](int i, int j) {
+        auto u = (i + random_double()) / (job.width-1);
+        auto v = (j + random_double()) / (job.height-1);
+        return ray_color(cam.get_ray(u, v), *entry->bvh, scene_lights, job.max_depth,
+                         entry->materials.get());
+    }, 4, job.samples_per_pixel);
+
+    std::ostringstream done;
+    done << "done " << std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count() << '\n';
+    return connected && send_line(fd, done.str());
+}
+
+
+#endif
@@ -0,0 +1,347 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "color.h"
+#include "environment.h"
+#include "hittable_list.h"
+#include "integrator.h"
+#include "material_table.h"
+#include "memory_stats.h"
+#include "qbvh.h"
+#include "thread_pool.h"
+#include "tile_culling.h"
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+
+// Renderizacao como biblioteca.
+//
+// renderer::render recebe a cena, a camera e as configuracoes e volta na hora com um
+// render_handle. O trabalho e dividido em (passada, tile); cada passada soma algumas
+// amostras a todos os tiles, entao a imagem parcial fica inteira cedo e vai refinando.
+// Os tiles rodam como tarefas no pool compartilhado: cada trabalho mantem no maximo uma
+// tarefa por thread do pool, e cada tarefa faz um tile e volta para o fim da fila. Varios
+// trabalhos no mesmo pool se revezam tile a tile, sem criar threads.
+//
+// O cancelamento e cooperativo: os tiles em andamento terminam, os outros nao comecam.
+//
+// Em maquinas NUMA cada no tem a sua copia das somas da imagem, alocada e zerada por uma
+// thread do proprio no, e as threads so escrevem na do seu no; framebuffer() soma as
+// copias. Com um no so ha uma copia, como antes.
+//
+// Tiles que so veem o fundo (tile_culling.h) recebem poucas amostras na primeira passada
+// e sao pulados nas outras.
+
+struct render_scene {
+    hittable_list world;
+    hittable_list lights;   // sampled directly; usually also in world
+    environment env;
+};
+
+
+// The tree and material table of a scene, built once for all of its jobs.
+struct prepared_scene {
+    std::once_flag built;
+    std::unique_ptr<qbvh> bvh;
+    std::unique_ptr<material_table> materials;
+    std::unique_ptr<tile_culler> culler;
+};
+
+
+struct render_settings {
+    int image_width = 400;
+    int image_height = 266;
+    int samples_per_pixel = 100;
+    int samples_per_pass = 4;
+    int max_depth = 50;
+    int tile_size = 32;
+    bool cull_background_tiles = true;   // see tile_culling.h
+};
+
+
+class render_handle {
+    public:
+        using progress_function = std::function<void(double)>;
+
+        // Fraction of the work done, from 0 to 1.
+        double progress() const {
+            return units == 0 ? 1.0 : double(units_done.load()) / units;
+        }
+
+        // Stops the job at the next tile. The result then becomes false.
+        void cancel() { cancel_requested = true; }
+        bool cancelled() const { return cancel_requested; }
+
+        // Becomes true once every sample is in, false if the job was cancelled first.
+        // Do not wait on it from a thread of the job's pool.
+        std::shared_future<bool> result() const { return finished; }
+        bool wait() const { return finished.get(); }
+
+        // Mean color of every pixel so far, row 0 at the bottom; black where no sample
+        // landed yet. Safe to call while the job runs.
+        std::vector<color> framebuffer() const;
+
+        // Plain-text PPM of framebuffer(), the top row first, like main() writes.
+        void write(std::ostream& out) const;
+
+        int image_width() const { return settings.image_width; }
+        int image_height() const { return settings.image_height; }
+
+    private:
+        friend class renderer;
+
+        render_handle(
+            std::shared_ptr<const render_scene> s, std::shared_ptr<prepared_scene> ps,
+            const camera& c, const render_settings& r, progress_function p, thread_pool& tp);
+
+        void start(const std::shared_ptr<render_handle>& self);
+        void run(const std::shared_ptr<render_handle>& self);
+        void render_unit(int unit);
+        void finish();
+
+        // Sums of the samples taken on one NUMA node, allocated by its first tile.
+        struct node_film {
+            std::once_flag allocated;
+            std::mutex mutex;   // guards sum and count
+            std::vector<color> sum;
+            std::vector<int> count;
+            memory_charge bytes{memory_tag::framebuffers};
+        };
+
+    private:
+        std::shared_ptr<const render_scene> scene;
+        camera cam;
+        render_settings settings;
+        progress_function on_progress;
+        thread_pool& pool;
+
+        std::shared_ptr<prepared_scene> prepared;
+
+        int tiles_across = 0, tiles = 0, passes = 0, units = 0;
+        std::vector<char> background_only;   // per tile, set before the runners start
+        std::atomic<int> next_unit{0};
+        std::atomic<int> units_done{0};
+        std::atomic<int> runners{0};
+        std::atomic<bool> cancel_requested{false};
+
+        std::vector<std::unique_ptr<node_film>> films;   // one per node of the pool
+
+        std::promise<bool> done;
+        std::shared_future<bool> finished;
+};
+
+
+class renderer {
+    public:
+        explicit renderer(thread_pool& p = default_thread_pool()) : pool(p) {}
+
+        // Starts rendering and returns at once. on_progress, when set, is called from the
+        // pool's threads with the fraction done after every tile; keep it short. The scene
+        // must not change until the job's result is ready.
+        std::shared_ptr<render_handle> render(
+            std::shared_ptr<const render_scene> scene, const camera& cam,
+            const render_settings& settings, render_handle::progress_function on_progress = nullptr
+        ) {
+            std::shared_ptr<render_handle> job(
+                new render_handle(scene, prepare(scene), cam, settings, on_progress, pool));
+            job->start(job);
+            return job;
+        }
+
+    private:
+        std::shared_ptr<prepared_scene> prepare(const std::shared_ptr<const render_scene>& scene) {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (auto it = prepared.begin(); it != prepared.end();) {
+                if (it->first.expired())
+                    it = prepared.erase(it);
+                else if (it->first.lock() == scene)
+                    return it->second;
+                else
+                    ++it;
+            }
+            prepared.emplace_back(scene, std::make_shared<prepared_scene>());
+            return prepared.back().second;
+        }
+
+    private:
+        thread_pool& pool;
+        std::mutex mutex;   // guards prepared
+        std::vector<std::pair<std::weak_ptr<const render_scene>, std::shared_ptr<prepared_scene>>> prepared;
+};
+
+
+render_handle::render_handle(
+    std::shared_ptr<const render_scene> s, std::shared_ptr<prepared_scene> ps,
+    const camera& c, const render_settings& r, progress_function p, thread_pool& tp
+) : scene(s), cam(c), settings(r), on_progress(p), pool(tp), prepared(ps) {
+    settings.image_width = std::max(settings.image_width, 1);
+    settings.image_height = std::max(settings.image_height, 1);
+    settings.samples_per_pixel = std::max(settings.samples_per_pixel, 1);
+    settings.samples_per_pass = std::min(std::max(settings.samples_per_pass, 1), settings.samples_per_pixel);
+    settings.tile_size = std::max(settings.tile_size, 1);
+
+    tiles_across = (settings.image_width + settings.tile_size - 1) / settings.tile_size;
+    auto tiles_down = (settings.image_height + settings.tile_size - 1) / settings.tile_size;
+    tiles = tiles_across * tiles_down;
+    passes = (settings.samples_per_pixel + settings.samples_per_pass - 1) / settings.samples_per_pass;
+    units = tiles * passes;
+
+    for (int n = 0; n < pool.nodes(); n++)
+        films.emplace_back(new node_film);
+    finished = done.get_future().share();
+}
+
+
+void render_handle::start(const std::shared_ptr<render_handle>& self) {
+    // The tree is built on the pool too, by the first job of the scene, then the
+    // runners take over.
+    runners = 1;
+    pool.submit([self] {
+        auto& p = *self->prepared;
+        std::call_once(p.built, [&] {
+            perf_phase phase(render_phase::scene_build);
+            p.bvh.reset(new qbvh(self->scene->world));
+            p.materials.reset(new material_table(self->scene->world));
+            p.culler.reset(new tile_culler(*p.bvh));
+        });
+
+        self->background_only.assign(self->tiles, 0);
+        if (self->settings.cull_background_tiles) {
+            auto w = self->settings.image_width, h = self->settings.image_height, size = self->settings.tile_size;
+            for (int tile = 0; tile < self->tiles; tile++) {
+                auto x0 = (tile % self->tiles_across) * size, y0 = (tile / self->tiles_across) * size;
+                self->background_only[tile] = p.culler->empty(
+                    self->cam, x0, y0, std::min(x0 + size, w), std::min(y0 + size, h), w, h);
+            }
+        }
+
+        auto extra = std::min<size_t>(self->pool.size(), self->units) - 1;
+        self->runners += static_cast<int>(extra);
+        for (size_t i = 0; i < extra; i++)
+            self->pool.submit([self] { self->run(self); });
+        self->run(self);
+    });
+}
+
+
+void render_handle::run(const std::shared_ptr<render_handle>& self) {
+    if (!cancel_requested) {
+        auto unit = next_unit.fetch_add(1);
+        if (unit < units) {
+            render_unit(unit);
+            auto done_now = units_done.fetch_add(1) + 1;
+            if (on_progress)
+                on_progress(double(done_now) / units);
+        }
+    }
+
+    // Back to the end of the queue, so other jobs get their turn.
+    if (!cancel_requested && next_unit.load() < units) {
+        pool.submit([self] { self->run(self); });
+        return;
+    }
+    if (runners.fetch_sub(1) == 1)
+        finish();
+}
+
+
+void render_handle::render_unit(int unit) {
+    auto pass = unit / tiles, tile = unit % tiles;
+    auto samples = std::min(settings.samples_per_pass,
+                            settings.samples_per_pixel - pass * settings.samples_per_pass);
+    auto w = settings.image_width, h = settings.image_height;
+    auto x0 = (tile % tiles_across) * settings.tile_size;
+    auto y0 = (tile / tiles_across) * settings.tile_size;
+    auto x1 = std::min(x0 + settings.tile_size, w), y1 = std::min(y0 + settings.tile_size, h);
+
+    light_set lights{scene->lights, scene->env};
+    std::vector<color> tile_sum(static_cast<size_t>(x1 - x0) * (y1 - y0));
+
+    // A background tile is done in the first pass, as one sample of its mean color.
+    if (background_only[tile]) {
+        if (pass > 0)
+            return;
+        samples = 1;
+    }
+
+    for (int j = y0; j < y1; j++) {
+        for (int i = x0; i < x1; i++) {
+            if (background_only[tile]) {
+                tile_sum[static_cast<size_t>(j - y0) * (x1 - x0) + (i - x0)] = background_pixel(cam, lights, i, j, w, h);
+                continue;
+            }
+            color pixel_color(0, 0, 0);
+            for (int s = 0; s < samples; ++s) {
+                auto u = (i + random_double()) / (w-1);
+                auto v = (j + random_double()) / (h-1);
+                pixel_color += ray_color(cam.get_ray(u, v), *prepared->bvh, lights, settings.max_depth,
+                                         prepared->materials.get());
+            }
+            tile_sum[static_cast<size_t>(j - y0) * (x1 - x0) + (i - x0)] = pixel_color;
+        }
+    }
+
+    // First touch from this thread puts the film's pages on its node.
+    auto& film = *films[pool.worker_node()];
+    std::call_once(film.allocated, [&] {
+        auto pixels = static_cast<size_t>(w) * h;
+        film.sum.assign(pixels, color(0, 0, 0));
+        film.count.assign(pixels, 0);
+        film.bytes.set(pixels * (sizeof(color) + sizeof(int)));
+    });
+
+    std::lock_guard<std::mutex> lock(film.mutex);
+    for (int j = y0; j < y1; j++)
+        for (int i = x0; i < x1; i++) {
+            auto k = static_cast<size_t>(j) * w + i;
+            film.sum[k] += tile_sum[static_cast<size_t>(j - y0) * (x1 - x0) + (i - x0)];
+            film.count[k] += samples;
+        }
+}
+
+
+void render_handle::finish() {
+    done.set_value(!cancel_requested && units_done.load() == units);
+}
+
+
+std::vector<color> render_handle::framebuffer() const {
+    auto size = static_cast<size_t>(settings.image_width) * settings.image_height;
+    std::vector<color> sum(size, color(0, 0, 0));
+    std::vector<int> count(size, 0);
+    for (const auto& film : films) {
+        std::lock_guard<std::mutex> lock(film->mutex);
+        for (size_t k = 0; k < film->sum.size(); k++) {
+            sum[k] += film->sum[k];
+            count[k] += film->count[k];
+        }
+    }
+
+    std::vector<color> pixels(size);
+    for (size_t k = 0; k < size; k++)
+        pixels[k] = count[k] ? sum[k] / count[k] : color(0, 0, 0);
+    return pixels;
+}
+
+
+void render_handle::write(std::ostream& out) const {
+    auto pixels = framebuffer();
+    auto w = settings.image_width, h = settings.image_height;
+    out << "P3\n" << w << ' ' << h << "\n255\n";
+    for (int j = h-1; j >= 0; --j)
+        for (int i = 0; i < w; ++i)
+            write_color(out, pixels[static_cast<size_t>(j) * w + i], 1);
+}
+
+
+#endif
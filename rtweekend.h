@@ -5,6 +5,7 @@
 #include <limits>
 #include <memory>
 
+#include <atomic>
 #include <random>
 #include <cstdlib>
 
@@ -25,9 +26,16 @@ inline double degrees_to_radians(double degrees) {
 
 
 
+// Um gerador por thread, cada um com a sua semente, para poder renderizar em paralelo.
+inline std::mt19937& random_generator() {
+   static std::atomic<unsigned> next_seed{5489};
+   thread_local std::mt19937 generator(next_seed++);
+   return generator;
+}
+
 inline double random_double() {
    // Returns a random real in [0,1).
-   return rand() / (RAND_MAX + 1.0);
+   return random_generator()() / 4294967296.0;
 }
 
 inline double random_double(double min, double max) {
@@ -51,6 +59,7 @@ inline int random_int(int min, int max) {
 
 
 // Common Headers
+#include "arena.h"
 #include "ray.h"
 #include "vec3.h"
 
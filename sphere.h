@@ -2,6 +2,7 @@
 #define SPHERE_H
 
 #include "hittable.h"
+#include "onb.h"
 #include "vec3.h"
 
 class sphere : public hittable {
@@ -13,14 +14,26 @@ class sphere : public hittable {
         virtual bool hit(
             const ray &r, double t_min, double t_max, hit_record &rec) const override;
 
+        virtual bool bounding_box(aabb& output_box) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool closest_hit(const ray& r, double t_min, double t_max, hit_summary& out) const override;
+
+        virtual double pdf_value(const point3& o, const vec3& v) const override;
+        virtual vec3 random(const point3& o) const override;
+
     public:
         point3 center;
         double radius;
         shared_ptr<material> mat_ptr;
-};
 
-bool sphere::hit(const ray &r, double t_min, double t_max, hit_record &rec) const {
+    private:
+        // The nearest root that lies in [t_min, t_max].
+        bool nearest_root(const ray& r, double t_min, double t_max, double& root) const;
+};
 
+bool sphere::nearest_root(const ray& r, double t_min, double t_max, double& root) const {
     vec3 oc = r.origin() - center;
     auto a = r.direction().length_squared();
     auto half_b = dot(oc, r.direction());
@@ -31,21 +44,98 @@ bool sphere::hit(const ray &r, double t_min, double t_max, hit_record &rec) cons
         return false;
     auto sqrtd = sqrt(discriminant);
 
-    // Find the nearest root that lies in the acceptable range.
-    auto root = (-half_b - sqrtd) / a;
+    root = (-half_b - sqrtd) / a;
     if (root < t_min || t_max < root) {
         root = (-half_b + sqrtd) / a;
         if (root < t_min || t_max < root)
             return false;
     }
+    return true;
+}
+
+bool sphere::hit(const ray &r, double t_min, double t_max, hit_record &rec) const {
+    double root;
+    if (!nearest_root(r, t_min, t_max, root))
+        return false;
 
     rec.t = root;
     rec.p = r.at(rec.t);
     vec3 outward_normal = (rec.p - center) / radius;
     rec.set_face_normal(r, outward_normal);
     rec.mat_ptr = mat_ptr;
+    rec.object = this;
+
+    return true;
+}
 
+bool sphere::closest_hit(const ray& r, double t_min, double t_max, hit_summary& out) const {
+    double root;
+    if (!nearest_root(r, t_min, t_max, root))
+        return false;
+    out.t = root;
+    out.object = this;
+    out.mat = mat_ptr.get();
     return true;
 }
 
+bool sphere::occluded(const ray &r, double t_min, double t_max) const {
+    vec3 oc = r.origin() - center;
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius * radius;
+
+    auto discriminant = half_b * half_b - a * c;
+    if (discriminant < 0)
+        return false;
+    auto sqrtd = sqrt(discriminant);
+
+    auto root = (-half_b - sqrtd) / a;
+    if (t_min <= root && root <= t_max)
+        return true;
+    root = (-half_b + sqrtd) / a;
+    return t_min <= root && root <= t_max;
+}
+
+bool sphere::bounding_box(aabb& output_box) const {
+    auto r = fabs(radius);
+    output_box = aabb(center - vec3(r, r, r), center + vec3(r, r, r));
+    return true;
+}
+
+inline vec3 random_to_sphere(double radius, double distance_squared) {
+    auto r1 = random_double();
+    auto r2 = random_double();
+    auto z = 1 + r2*(sqrt(1-radius*radius/distance_squared) - 1);
+
+    auto phi = 2*pi*r1;
+    auto x = cos(phi)*sqrt(1-z*z);
+    auto y = sin(phi)*sqrt(1-z*z);
+
+    return vec3(x, y, z);
+}
+
+double sphere::pdf_value(const point3& o, const vec3& v) const {
+    // Uniform over the cone of directions subtended by the sphere.
+    if (!occluded(ray(o, v), 0.001, infinity))
+        return 0;
+
+    auto distance_squared = (center - o).length_squared();
+    if (distance_squared <= radius*radius)
+        return 0;
+    auto cos_theta_max = sqrt(1 - radius*radius/distance_squared);
+    auto solid_angle = 2*pi*(1-cos_theta_max);
+
+    return 1 / solid_angle;
+}
+
+vec3 sphere::random(const point3& o) const {
+    vec3 direction = center - o;
+    auto distance_squared = direction.length_squared();
+    if (distance_squared <= radius*radius)
+        return random_unit_vector();
+    onb uvw;
+    uvw.build_from_w(direction);
+    return uvw.local(random_to_sphere(radius, distance_squared));
+}
+
 #endif
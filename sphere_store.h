@@ -0,0 +1,350 @@
+#ifndef SPHERE_STORE_H
+#define SPHERE_STORE_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "intern.h"
+#include "material.h"
+#include "memory_stats.h"
+#include "qbvh.h"
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+
+// Esferas compactas para cenas com milhoes de esferas.
+//
+// Cada esfera ocupa 16 bytes: centro em float, raio em meia precisao (16 bits) e o indice
+// do material em 16 bits. Os materiais ficam numa tabela da propria store, e a store tem
+// sua propria qbvh_tree; depois de construida, as esferas sao reordenadas na ordem das
+// folhas, entao a arvore indexa as esferas diretamente e nao guarda referencias.
+//
+// O raio em meia precisao tem 11 bits significativos: serve para esferas pequenas e
+// medias, mas esferas enormes como o chao de random_scene devem continuar como sphere.
+
+struct compact_sphere {
+    float center[3];
+    uint16_t radius;     // IEEE half
+    uint16_t material;   // index into sphere_store::materials
+};
+
+static_assert(sizeof(compact_sphere) == 16, "compact_sphere must be 16 bytes");
+
+
+// Round-to-nearest float -> half conversion, for finite, non-negative values.
+inline uint16_t float_to_half(float x) {
+    uint32_t bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    auto exponent = static_cast<int>((bits >> 23) & 0xff) - 127 + 15;
+    auto mantissa = bits & 0x7fffff;
+
+    if (exponent >= 31)
+        return 0x7bff;  // largest finite half
+    if (exponent <= 0) {
+        if (exponent < -10)
+            return 0;
+        mantissa |= 0x800000;
+        auto shift = 14 - exponent;
+        return static_cast<uint16_t>((mantissa + (1u << (shift - 1))) >> shift);
+    }
+
+    // A mantissa carry bumps the exponent, which is still the right rounding.
+    auto half = static_cast<uint32_t>(exponent << 10) | (mantissa >> 13);
+    half += (mantissa >> 12) & 1;
+    return static_cast<uint16_t>(std::min<uint32_t>(half, 0x7bff));
+}
+
+inline float half_to_float(uint16_t h) {
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+    if (exponent == 0)
+        return static_cast<float>(mantissa) * (1.0f / 16777216.0f);  // subnormal: m * 2^-24
+
+    // Rebias the exponent and widen the mantissa; no rounding needed in this direction.
+    uint32_t bits = ((exponent + 127 - 15) << 23) | (mantissa << 13);
+    float x;
+    std::memcpy(&x, &bits, sizeof(x));
+    return x;
+}
+
+
+class sphere_store : public hittable {
+    public:
+        sphere_store() {}
+
+        // Adds a sphere, returning false when the material table is full.
+        bool add(const point3& center, double radius, const shared_ptr<material>& m);
+
+        // Builds the tree and reorders the spheres to match it; call after adding.
+        void build(thread_pool* pool = &default_thread_pool());
+
+        size_t size() const { return spheres.size(); }
+
+        virtual bool hit(
+            const ray& r, double t_min, double t_max, hit_record& rec) const override;
+
+        virtual bool bounding_box(aabb& output_box) const override;
+
+        virtual bool occluded(const ray& r, double t_min, double t_max) const override;
+
+        virtual bool closest_hit(const ray& r, double t_min, double t_max, hit_summary& out) const override;
+
+    public:
+        std::vector<compact_sphere> spheres;
+        std::vector<shared_ptr<material>> materials;
+        qbvh_tree tree;
+
+    private:
+        memory_charge sphere_bytes{memory_tag::primitives};
+        memory_charge tree_bytes{memory_tag::acceleration};
+        std::unordered_map<const material*, uint16_t> material_index;   // position in materials
+
+        static aabb box_of(const compact_sphere& s);
+
+        // Distance to the nearest root in [t_min, t_max], or a negative value on a miss.
+        static double intersect(const compact_sphere& s, const ray& r, double t_min, double t_max);
+};
+
+
+aabb sphere_store::box_of(const compact_sphere& s) {
+    auto r = static_cast<double>(half_to_float(s.radius));
+    point3 c(s.center[0], s.center[1], s.center[2]);
+    return aabb(c - vec3(r, r, r), c + vec3(r, r, r));
+}
+
+
+bool sphere_store::add(const point3& center, double radius, const shared_ptr<material>& m) {
+    // materials is public, so the index is rebuilt whenever it was filled directly.
+    if (material_index.size() != materials.size()) {
+        material_index.clear();
+        for (size_t i = 0; i < materials.size() && i <= UINT16_MAX; i++)
+            material_index.emplace(materials[i].get(), static_cast<uint16_t>(i));
+    }
+
+    uint32_t index;
+    auto known = material_index.find(m.get());
+    if (known != material_index.end()) {
+        index = known->second;
+    } else {
+        if (materials.size() > UINT16_MAX) {
+            std::cerr << "ERROR: sphere_store holds at most 65536 materials.\n";
+            return false;
+        }
+        index = static_cast<uint32_t>(materials.size());
+        material_index.emplace(m.get(), static_cast<uint16_t>(index));
+        materials.push_back(m);
+    }
+
+    compact_sphere s;
+    for (int a = 0; a < 3; a++)
+        s.center[a] = static_cast<float>(center[a]);
+    s.radius = float_to_half(static_cast<float>(fabs(radius)));
+    s.material = static_cast<uint16_t>(index);
+    spheres.push_back(s);
+    return true;
+}
+
+
+void sphere_store::build(thread_pool* pool) {
+    tree.build(static_cast<uint32_t>(spheres.size()),
+        [this](uint32_t i) { return box_of(spheres[i]); }, pool);
+
+    // Gather the spheres into leaf order in place, following each cycle of the
+    // permutation and marking visited positions as fixed points.
+    auto& order = tree.prim_refs;
+    for (uint32_t i = 0; i < order.size(); i++) {
+        if (order[i] == i)
+            continue;
+        auto first = spheres[i];
+        auto j = i;
+        while (true) {
+            auto k = order[j];
+            order[j] = j;
+            if (k == i) {
+                spheres[j] = first;
+                break;
+            }
+            spheres[j] = spheres[k];
+            j = k;
+        }
+    }
+
+    std::vector<uint32_t>().swap(order);
+
+    sphere_bytes.set(spheres.capacity() * sizeof(compact_sphere));
+    tree_bytes.set(tree.nodes.capacity() * sizeof(qbvh_node));
+    numa_interleave(spheres.data(), spheres.size() * sizeof(compact_sphere));
+    numa_interleave(tree.nodes.data(), tree.nodes.size() * sizeof(qbvh_node));
+}
+
+
+double sphere_store::intersect(const compact_sphere& s, const ray& r, double t_min, double t_max) {
+    vec3 oc = r.origin() - point3(s.center[0], s.center[1], s.center[2]);
+    auto radius = static_cast<double>(half_to_float(s.radius));
+    auto a = r.direction().length_squared();
+    auto half_b = dot(oc, r.direction());
+    auto c = oc.length_squared() - radius * radius;
+
+    auto discriminant = half_b * half_b - a * c;
+    if (discriminant < 0)
+        return -1;
+    auto sqrtd = sqrt(discriminant);
+
+    auto root = (-half_b - sqrtd) / a;
+    if (root < t_min || t_max < root) {
+        root = (-half_b + sqrtd) / a;
+        if (root < t_min || t_max < root)
+            return -1;
+    }
+    return root;
+}
+
+
+bool sphere_store::closest_hit(const ray& r, double t_min, double t_max, hit_summary& out) const {
+    const compact_sphere* closest = nullptr;
+    tree.closest(r, t_min, t_max, [&](uint32_t i, double t_max) {
+        auto root = intersect(spheres[i], r, t_min, t_max);
+        if (root < 0)
+            return t_max;
+        closest = &spheres[i];
+        out.t = root;
+        return root;
+    });
+
+    if (!closest)
+        return false;
+    out.object = closest;
+    out.mat = materials[closest->material].get();
+    return true;
+}
+
+
+bool sphere_store::hit(const ray& r, double t_min, double t_max, hit_record& rec) const {
+    // Only the closest sphere fills the record, so the material pointer is copied once.
+    hit_summary found;
+    if (!closest_hit(r, t_min, t_max, found))
+        return false;
+
+    auto closest = static_cast<const compact_sphere*>(found.object);
+    auto t = found.t;
+
+    point3 center(closest->center[0], closest->center[1], closest->center[2]);
+    rec.t = t;
+    rec.p = r.at(t);
+    vec3 outward_normal = (rec.p - center) / static_cast<double>(half_to_float(closest->radius));
+    rec.set_face_normal(r, outward_normal);
+    rec.mat_ptr = materials[closest->material];
+    rec.object = closest;
+
+    return true;
+}
+
+
+bool sphere_store::occluded(const ray& r, double t_min, double t_max) const {
+    return tree.any(r, t_min, t_max, [&](uint32_t i) {
+        return intersect(spheres[i], r, t_min, t_max) >= 0;
+    });
+}
+
+
+bool sphere_store::bounding_box(aabb& output_box) const {
+    if (tree.empty())
+        return false;
+    output_box = tree.node_box(0);
+    return true;
+}
+
+
+// Hash used by the generator, so every sphere depends only on the seed and its index and
+// the result is the same for any number of threads.
+inline uint64_t splitmix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ull;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+    return x ^ (x >> 31);
+}
+
+inline double hash_double(uint64_t& state) {
+    state = splitmix64(state);
+    return (state >> 11) * (1.0 / 9007199254740992.0);
+}
+
+
+// The small spheres of random_scene on a grid of about `count` cells centered on the
+// origin, with the same 80% diffuse, 15% metal, 5% glass mix. Materials come from a
+// fixed palette taken from the registry. Spheres that would overlap one of the `avoid`
+// spheres (center, radius) are left out, as random_scene leaves room for its large
+// spheres, so the store may end up a little smaller than `count`. Cells are filled in
+// parallel and the store is built before returning.
+void generate_spheres(
+    sphere_store& store, size_t count, uint64_t seed, resource_registry& registry,
+    const std::vector<std::pair<point3, double>>& avoid = {},
+    thread_pool& pool = default_thread_pool()
+) {
+    const int diffuse_colors = 512;
+    const int metal_colors = 256;
+
+    // The palette is drawn from the seed too, in order, before the parallel part.
+    store.materials.clear();
+    auto state = splitmix64(seed);
+    for (int i = 0; i < diffuse_colors; i++) {
+        color albedo;
+        for (int a = 0; a < 3; a++)
+            albedo[a] = hash_double(state) * hash_double(state);
+        store.materials.push_back(registry.get<lambertian>(albedo));
+    }
+    for (int i = 0; i < metal_colors; i++) {
+        color albedo;
+        for (int a = 0; a < 3; a++)
+            albedo[a] = 0.5 + 0.5*hash_double(state);
+        auto fuzz = 0.5*hash_double(state);
+        store.materials.push_back(registry.get<metal>(albedo, fuzz));
+    }
+    store.materials.push_back(registry.get<dielectric>(1.5));
+
+    auto side = static_cast<size_t>(ceil(sqrt(static_cast<double>(count))));
+    auto half_side = static_cast<double>(side) / 2;
+    auto radius = float_to_half(0.2f);
+
+    store.spheres.resize(count);
+    pool.parallel_for(0, count, 1 << 16, [&](size_t begin, size_t end) {
+        for (auto i = begin; i < end; i++) {
+            auto h = splitmix64(seed ^ splitmix64(i));
+            auto choose_mat = hash_double(h);
+
+            auto& s = store.spheres[i];
+            s.center[0] = static_cast<float>(i % side - half_side + 0.9*hash_double(h));
+            s.center[1] = 0.2f;
+            s.center[2] = static_cast<float>(i / side - half_side + 0.9*hash_double(h));
+            s.radius = radius;
+
+            if (choose_mat < 0.8)
+                s.material = static_cast<uint16_t>(h % diffuse_colors);
+            else if (choose_mat < 0.95)
+                s.material = static_cast<uint16_t>(diffuse_colors + h % metal_colors);
+            else
+                s.material = static_cast<uint16_t>(diffuse_colors + metal_colors);
+
+            // A zero radius marks a sphere to drop below.
+            point3 center(s.center[0], s.center[1], s.center[2]);
+            for (const auto& a : avoid)
+                if ((center - a.first).length() < a.second + 0.2)
+                    s.radius = 0;
+        }
+    });
+
+    if (!avoid.empty())
+        store.spheres.erase(std::remove_if(store.spheres.begin(), store.spheres.end(),
+            [](const compact_sphere& s) { return s.radius == 0; }), store.spheres.end());
+
+    store.build(&pool);
+}
+
+
+#endif
@@ -0,0 +1,74 @@
+#include "rtweekend.h"
+
+#include "hittable_list.h"
+#include "intern.h"
+#include "qbvh.h"
+#include "sphere.h"
+#include "sphere_store.h"
+
+#include <iostream>
+
+
+// Confere a sphere_store de ponta a ponta contra esferas comuns numa qbvh: gera a cena de
+// massive_random_scene, refaz as mesmas esferas (centro em float, raio em meia precisao)
+// como objetos sphere e compara os acertos de raios aleatorios:
+//
+//     g++ -std=c++17 -O2 -pthread sphere_store_test.cpp -o sphere_store_test && ./sphere_store_test
+//
+// Sai com 1 se algum raio der resultado diferente, se alguma esfera pequena invadir uma
+// das grandes, ou se add() repetir um material.
+
+int main() {
+    int failed = 0;
+    resource_registry registry;
+
+    const std::vector<std::pair<point3, double>> large = {
+        {point3(0, 1, 0), 1.0}, {point3(-4, 1, 0), 1.0}, {point3(4, 1, 0), 1.0}};
+    sphere_store store;
+    generate_spheres(store, 200000, 7, registry, large);
+
+    size_t overlaps = 0;
+    hittable_list reference;
+    for (const auto& s : store.spheres) {
+        point3 center(s.center[0], s.center[1], s.center[2]);
+        auto radius = static_cast<double>(half_to_float(s.radius));
+        for (const auto& l : large)
+            overlaps += (center - l.first).length() < l.second + radius;
+        reference.add(make_shared<sphere>(center, radius, store.materials[s.material]));
+    }
+    std::cerr << store.size() << " spheres, " << overlaps << " overlapping the large ones (bound 0)\n";
+    if (overlaps != 0 || store.size() == 0)
+        failed++;
+
+    qbvh tree(reference);
+    long long mismatches = 0, hits = 0;
+    const int count = 1000000;
+    auto half = std::sqrt(200000.0) / 2;
+    for (int i = 0; i < count; i++) {
+        point3 from(random_double(-half, half), random_double(0.5, 10), random_double(-half, half));
+        point3 to(random_double(-half, half), 0, random_double(-half, half));
+        ray r(from, to - from);
+
+        hit_record a, b;
+        auto hit_store = store.hit(r, 0.001, infinity, a);
+        auto hit_tree = tree.hit(r, 0.001, infinity, b);
+        hits += hit_store;
+        if (hit_store != hit_tree
+                || (hit_store && (std::fabs(a.t - b.t) > 1e-9 * b.t || a.mat_ptr != b.mat_ptr)))
+            mismatches++;
+    }
+    std::cerr << count << " rays, " << hits << " hits, " << mismatches << " mismatches (bound 0)\n";
+    if (mismatches != 0)
+        failed++;
+
+    // add() keeps one slot per material, also after the palette was filled directly.
+    auto before = store.materials.size();
+    store.add(point3(0, 0.2, 50), 0.2, store.materials[3]);
+    store.add(point3(1, 0.2, 50), 0.2, registry.get<lambertian>(color(0.1, 0.2, 0.3)));
+    store.add(point3(2, 0.2, 50), 0.2, registry.get<lambertian>(color(0.1, 0.2, 0.3)));
+    std::cerr << "add: " << store.materials.size() - before << " new materials (expected 1)\n";
+    if (store.materials.size() - before != 1 || store.spheres.back().material != before)
+        failed++;
+
+    return failed ? 1 : 0;
+}
@@ -13,6 +13,9 @@
 
 #include "rtweekend.h"
 
+#include "fast_math.h"
+#include "memory_stats.h"
+#include "numa.h"
 #include "perlin.h"
 #include "rtw_stb_image.h"
 
@@ -38,6 +41,7 @@ class solid_color : public texture {
         }
 
     private:
+        friend class material_table;
         color color_value;
 };
 
@@ -50,10 +54,10 @@ class checker_texture : public texture {
             : even(_even), odd(_odd) {}
 
         checker_texture(color c1, color c2)
-            : even(make_shared<solid_color>(c1)) , odd(make_shared<solid_color>(c2)) {}
+            : even(make_scene_ptr<solid_color>(c1)) , odd(make_scene_ptr<solid_color>(c2)) {}
 
         virtual color value(double u, double v, const vec3& p) const override {
-            auto sines = sin(10*p.x())*sin(10*p.y())*sin(10*p.z());
+            auto sines = fast_sin(10*p.x())*fast_sin(10*p.y())*fast_sin(10*p.z());
             if (sines < 0)
                 return odd->value(u, v, p);
             else
@@ -74,7 +78,7 @@ class noise_texture : public texture {
         virtual color value(double u, double v, const vec3& p) const override {
             // return color(1,1,1)*0.5*(1 + noise.turb(scale * p));
             // return color(1,1,1)*noise.turb(scale * p);
-            return color(1,1,1)*0.5*(1 + sin(scale*p.z() + 10*noise.turb(p)));
+            return color(1,1,1)*0.5*(1 + fast_sin(scale*p.z() + 10*noise.turb(p)));
         }
 
     public:
@@ -90,7 +94,7 @@ class noise_texture2 : public texture {
         virtual color value(double u, double v, const vec3& p) const override {
             // return color(1,1,1)*0.5*(1 + noise.turb(scale * p));
             // return color(1,1,1)*noise.turb(scale * p);
-            return mColor*0.7*(1 + sin(scale*p.z() + 7*random_double()*noise.turb(p)));
+            return mColor*0.7*(1 + fast_sin(scale*p.z() + 7*random_double()*noise.turb(p)));
         }
 
     public:
@@ -105,9 +109,9 @@ class image_texture : public texture {
         const static int bytes_per_pixel = 3;
 
         image_texture()
-          : data(nullptr), width(0), height(0), bytes_per_scanline(0) {}
+          : data(nullptr), width(0), height(0), bytes_per_scanline(0), pixel_bytes(memory_tag::image_pixels) {}
 
-        image_texture(const char* filename) {
+        image_texture(const char* filename) : pixel_bytes(memory_tag::image_pixels) {
             auto components_per_pixel = bytes_per_pixel;
 
             data = stbi_load(
@@ -119,12 +123,25 @@ class image_texture : public texture {
             }
 
             bytes_per_scanline = bytes_per_pixel * width;
+            pixel_bytes.set(static_cast<size_t>(bytes_per_scanline) * height);
+            numa_interleave(data, static_cast<size_t>(bytes_per_scanline) * height);
         }
 
         ~image_texture() {
             STBI_FREE(data);
         }
 
+        // Takes over pixels decoded elsewhere with stbi_load, 3 bytes per pixel.
+        void assign(unsigned char* pixels, int w, int h) {
+            STBI_FREE(data);
+            data = pixels;
+            width = pixels ? w : 0;
+            height = pixels ? h : 0;
+            bytes_per_scanline = bytes_per_pixel * width;
+            pixel_bytes.set(static_cast<size_t>(bytes_per_scanline) * height);
+            numa_interleave(data, static_cast<size_t>(bytes_per_scanline) * height);
+        }
+
         virtual color value(double u, double v, const vec3& p) const override {
             // If we have no texture data, then return solid cyan as a debugging aid.
             if (data == nullptr)
@@ -151,6 +168,7 @@ class image_texture : public texture {
         unsigned char *data;
         int width, height;
         int bytes_per_scanline;
+        memory_charge pixel_bytes;
 };
 
 
@@ -0,0 +1,276 @@
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "rtweekend.h"
+
+#include "rtw_stb_image.h"
+#include "texture.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#if defined(_WIN32)
+#include <fstream>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+
+// Cache de texturas ja decodificadas.
+//
+// O arquivo guarda os texels RGBA de 8 bits (os mesmos valores que a image_texture usa),
+// com todos os niveis de mipmap, cada nivel em blocos de 8x8 texels. A textura faz mmap
+// do arquivo e le os texels direto dele, sem copiar: varios processos renderizando ao
+// mesmo tempo usam as mesmas paginas do page cache. write_texture_cache converte uma
+// imagem JPEG/PNG para esse formato (veja make_texture_cache.cpp).
+//
+// As cenas pedem as imagens pelo nome de sempre (earthmap.jpg); se houver ao lado um
+// cache com a extensao .rttc (earthmap.rttc) e ele nao for mais velho que a imagem,
+// open_texture_cache o usa no lugar de decodificar a imagem.
+
+struct texture_cache_header {
+    char magic[4];             // "RTTC"
+    uint32_t version;
+    uint32_t width, height;    // level 0
+    uint32_t levels;
+    uint32_t tile_size;
+    uint64_t level_offset[16]; // from the start of the file, 64-byte aligned
+};
+
+
+// Layout helpers shared by the writer and the reader.
+inline uint32_t cache_level_size(uint32_t size, uint32_t level) {
+    return std::max<uint32_t>(size >> level, 1);
+}
+
+inline size_t cache_texel_offset(uint32_t width, uint32_t tile_size, uint32_t i, uint32_t j) {
+    auto tiles_across = (width + tile_size - 1) / tile_size;
+    auto tile = static_cast<size_t>(j / tile_size) * tiles_across + i / tile_size;
+    return tile * tile_size * tile_size + (j % tile_size) * tile_size + (i % tile_size);
+}
+
+inline size_t cache_level_texels(uint32_t width, uint32_t height, uint32_t tile_size) {
+    auto tiles_across = (width + tile_size - 1) / tile_size;
+    auto tiles_down = (height + tile_size - 1) / tile_size;
+    return static_cast<size_t>(tiles_across) * tiles_down * tile_size * tile_size;
+}
+
+
+// Decodes `image_file` and writes it, with its mip chain, to `cache_file`.
+bool write_texture_cache(const char* image_file, const char* cache_file) {
+    int width, height, components;
+    auto pixels = stbi_load(image_file, &width, &height, &components, 4);
+    if (!pixels) {
+        std::cerr << "ERROR: Could not load texture image file '" << image_file << "'.\n";
+        return false;
+    }
+
+    texture_cache_header header = {{'R', 'T', 'T', 'C'}, 1,
+        static_cast<uint32_t>(width), static_cast<uint32_t>(height), 0, 8, {}};
+
+    // Box-filter each level down from the previous one, clamping at odd edges.
+    std::vector<std::vector<uint8_t>> levels;
+    levels.emplace_back(pixels, pixels + 4 * static_cast<size_t>(width) * height);
+    STBI_FREE(pixels);
+
+    while (levels.size() < 16 && (width > 1 || height > 1)) {
+        auto w = std::max(width / 2, 1), h = std::max(height / 2, 1);
+        const auto& src = levels.back();
+        std::vector<uint8_t> dst(4 * static_cast<size_t>(w) * h);
+        for (int j = 0; j < h; j++) {
+            for (int i = 0; i < w; i++) {
+                for (int c = 0; c < 4; c++) {
+                    int sum = 0;
+                    for (int dj = 0; dj < 2; dj++)
+                        for (int di = 0; di < 2; di++) {
+                            auto x = std::min(2*i + di, width - 1);
+                            auto y = std::min(2*j + dj, height - 1);
+                            sum += src[4 * (static_cast<size_t>(y) * width + x) + c];
+                        }
+                    dst[4 * (static_cast<size_t>(j) * w + i) + c] = static_cast<uint8_t>((sum + 2) / 4);
+                }
+            }
+        }
+        levels.push_back(std::move(dst));
+        width = w;
+        height = h;
+    }
+    header.levels = static_cast<uint32_t>(levels.size());
+
+    uint64_t offset = (sizeof(header) + 63) & ~uint64_t(63);
+    for (uint32_t l = 0; l < header.levels; l++) {
+        header.level_offset[l] = offset;
+        auto texels = cache_level_texels(cache_level_size(header.width, l),
+                                         cache_level_size(header.height, l), header.tile_size);
+        offset = (offset + 4 * texels + 63) & ~uint64_t(63);
+    }
+
+    auto f = fopen(cache_file, "wb");
+    if (!f) {
+        std::cerr << "ERROR: Could not write texture cache '" << cache_file << "'.\n";
+        return false;
+    }
+
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    for (uint32_t l = 0; ok && l < header.levels; l++) {
+        auto w = cache_level_size(header.width, l), h = cache_level_size(header.height, l);
+        std::vector<uint8_t> tiled(4 * cache_level_texels(w, h, header.tile_size), 0);
+        for (uint32_t j = 0; j < h; j++)
+            for (uint32_t i = 0; i < w; i++)
+                std::copy_n(&levels[l][4 * (static_cast<size_t>(j) * w + i)], 4,
+                            &tiled[4 * cache_texel_offset(w, header.tile_size, i, j)]);
+
+        ok = fseek(f, static_cast<long>(header.level_offset[l]), SEEK_SET) == 0
+            && fwrite(tiled.data(), 1, tiled.size(), f) == tiled.size();
+    }
+
+    fclose(f);
+    if (!ok)
+        std::cerr << "ERROR: Could not write texture cache '" << cache_file << "'.\n";
+    return ok;
+}
+
+
+class cached_texture : public texture {
+    public:
+        cached_texture(const char* filename) {
+            if (!map(filename) || !valid()) {
+                std::cerr << "ERROR: Could not load texture cache '" << filename << "'.\n";
+                unmap();
+            }
+        }
+
+        ~cached_texture() { unmap(); }
+
+        cached_texture(const cached_texture&) = delete;
+        cached_texture& operator=(const cached_texture&) = delete;
+
+        // Same lookup as image_texture, from level 0.
+        virtual color value(double u, double v, const vec3& p) const override {
+            if (header == nullptr)
+                return color(0,1,1);
+
+            u = clamp(u, 0.0, 1.0);
+            v = 1.0 - clamp(v, 0.0, 1.0);
+
+            auto i = std::min(static_cast<uint32_t>(u * header->width), header->width - 1);
+            auto j = std::min(static_cast<uint32_t>(v * header->height), header->height - 1);
+            return texel(0, i, j);
+        }
+
+        // Texel (i, j) of a mip level, with (0, 0) the top-left corner.
+        color texel(uint32_t level, uint32_t i, uint32_t j) const {
+            const auto color_scale = 1.0 / 255.0;
+            auto width = cache_level_size(header->width, level);
+            auto pixel = base + header->level_offset[level]
+                + 4 * cache_texel_offset(width, header->tile_size, i, j);
+            return color(color_scale*pixel[0], color_scale*pixel[1], color_scale*pixel[2]);
+        }
+
+        // False when the file could not be mapped or is not a valid cache.
+        bool loaded() const { return header != nullptr; }
+
+        uint32_t levels() const { return header ? header->levels : 0; }
+        uint32_t width(uint32_t level = 0) const { return header ? cache_level_size(header->width, level) : 0; }
+        uint32_t height(uint32_t level = 0) const { return header ? cache_level_size(header->height, level) : 0; }
+
+    private:
+        bool map(const char* filename) {
+#if defined(_WIN32)
+            // No mmap here: read the file into a private copy instead.
+            std::ifstream in(filename, std::ios::binary);
+            if (!in)
+                return false;
+            copy.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            base = reinterpret_cast<const uint8_t*>(copy.data());
+            size = copy.size();
+#else
+            auto fd = open(filename, O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(texture_cache_header))) {
+                close(fd);
+                return false;
+            }
+            size = static_cast<size_t>(st.st_size);
+            auto p = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+            close(fd);
+            if (p == MAP_FAILED)
+                return false;
+            base = static_cast<const uint8_t*>(p);
+#endif
+            header = reinterpret_cast<const texture_cache_header*>(base);
+            return true;
+        }
+
+        bool valid() const {
+            if (size < sizeof(texture_cache_header) || !std::equal(header->magic, header->magic + 4, "RTTC")
+                || header->version != 1 || header->width == 0 || header->height == 0
+                || header->levels == 0 || header->levels > 16 || header->tile_size == 0)
+                return false;
+            for (uint32_t l = 0; l < header->levels; l++) {
+                auto texels = cache_level_texels(width(l), height(l), header->tile_size);
+                if (header->level_offset[l] + 4 * texels > size)
+                    return false;
+            }
+            return true;
+        }
+
+        void unmap() {
+#if !defined(_WIN32)
+            if (base)
+                munmap(const_cast<uint8_t*>(base), size);
+#endif
+            base = nullptr;
+            header = nullptr;
+            size = 0;
+        }
+
+    private:
+        const uint8_t* base = nullptr;
+        const texture_cache_header* header = nullptr;
+        size_t size = 0;
+#if defined(_WIN32)
+        std::vector<char> copy;
+#endif
+};
+
+
+// Cache file that goes with an image: the same name with the extension .rttc.
+inline std::string texture_cache_name(const std::string& image_file) {
+    auto dot = image_file.find_last_of('.');
+    auto slash = image_file.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = image_file.size();
+    return image_file.substr(0, dot) + ".rttc";
+}
+
+
+// The cached texture for `image_file`, or null when there is no usable cache next to it
+// and the image has to be decoded. A cache older than its image is ignored.
+shared_ptr<cached_texture> open_texture_cache(const std::string& image_file) {
+    auto cache_file = texture_cache_name(image_file);
+#if defined(_WIN32)
+    if (!std::ifstream(cache_file, std::ios::binary))
+        return nullptr;
+#else
+    struct stat cache_st, image_st;
+    if (stat(cache_file.c_str(), &cache_st) != 0)
+        return nullptr;
+    if (stat(image_file.c_str(), &image_st) == 0 && image_st.st_mtime > cache_st.st_mtime)
+        return nullptr;
+#endif
+    auto texture = make_scene_ptr<cached_texture>(cache_file.c_str());
+    return texture->loaded() ? texture : nullptr;
+}
+
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef TEXTURE_LOADER_H
+#define TEXTURE_LOADER_H
+
+#include "rtweekend.h"
+
+#include "texture.h"
+#include "texture_cache.h"
+#include "thread_pool.h"
+
+#include <future>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+
+// Carregamento de texturas em paralelo.
+//
+// load() devolve na hora uma image_texture vazia e manda decodificar o arquivo no pool;
+// wait() espera todas as decodificacoes e entrega os pixels as texturas. Assim a cena
+// inteira e montada enquanto as imagens sao decodificadas, cada uma numa thread. O mesmo
+// arquivo pedido varias vezes e decodificado uma vez so e devolve a mesma textura.
+// Ate wait() as texturas ainda nao tem dados (e aparecem em ciano se forem usadas).
+// load_texture() prefere o cache .rttc da imagem (texture_cache.h), quando existe: ele e
+// mapeado na hora, sem decodificacao nenhuma.
+
+class texture_loader {
+    public:
+        texture_loader(thread_pool& p = default_thread_pool()) : pool(p) {}
+        ~texture_loader() { wait(); }
+
+        texture_loader(const texture_loader&) = delete;
+        texture_loader& operator=(const texture_loader&) = delete;
+
+        shared_ptr<image_texture> load(const char* filename) {
+            auto it = textures.find(filename);
+            if (it != textures.end())
+                return it->second;
+
+            auto texture = make_scene_ptr<image_texture>();
+            textures.emplace(filename, texture);
+
+            std::string name = filename;
+            jobs.push_back({texture, name, pool.async([name] {
+                decoded image;
+                auto components_per_pixel = image_texture::bytes_per_pixel;
+                image.data = stbi_load(name.c_str(), &image.width, &image.height,
+                                       &components_per_pixel, components_per_pixel);
+                return image;
+            })});
+            return texture;
+        }
+
+        // The image's .rttc cache if there is one, otherwise load(filename).
+        shared_ptr<texture> load_texture(const char* filename) {
+            auto it = cached.find(filename);
+            if (it != cached.end())
+                return it->second;
+            if (auto texture = open_texture_cache(filename)) {
+                cached.emplace(filename, texture);
+                return texture;
+            }
+            return load(filename);
+        }
+
+        // Blocks until every requested image is decoded and installed in its texture.
+        // Call it before rendering, from outside the pool.
+        void wait() {
+            for (auto& job : jobs) {
+                auto image = job.result.get();
+                if (!image.data)
+                    std::cerr << "ERROR: Could not load texture image file '" << job.filename << "'.\n";
+                job.texture->assign(image.data, image.width, image.height);
+            }
+            jobs.clear();
+        }
+
+        size_t pending() const { return jobs.size(); }
+
+    private:
+        struct decoded {
+            unsigned char* data = nullptr;
+            int width = 0, height = 0;
+        };
+
+        struct job {
+            shared_ptr<image_texture> texture;
+            std::string filename;
+            std::future<decoded> result;
+        };
+
+        thread_pool& pool;
+        std::unordered_map<std::string, shared_ptr<image_texture>> textures;
+        std::unordered_map<std::string, shared_ptr<cached_texture>> cached;
+        std::vector<job> jobs;
+};
+
+
+// Loader shared by the scene builders in main.cpp.
+inline texture_loader& default_texture_loader() {
+    static texture_loader loader;
+    return loader;
+}
+
+
+#endif
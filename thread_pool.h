@@ -0,0 +1,176 @@
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include "numa.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+// Pool de threads fixo com uma fila de tarefas.
+//
+// parallel_for divide um intervalo em blocos que as threads do pool e a propria thread
+// chamadora vao pegando; por isso pode ser chamado de dentro de uma tarefa sem travar.
+//
+// Com uma topologia de varios nos NUMA, cada thread e fixada numa CPU, alternando os nos,
+// e worker_node() diz em que no a thread roda. Com um no so as threads ficam soltas.
+
+class thread_pool {
+    public:
+        explicit thread_pool(
+            unsigned threads = std::thread::hardware_concurrency(), const numa_topology* placement = nullptr
+        ) : topology(placement && placement->multi_node() ? placement : nullptr) {
+            threads = std::max(threads, 1u);
+            for (unsigned i = 0; i < threads; i++)
+                workers.emplace_back([this, i] { run(i); });
+        }
+
+        ~thread_pool() {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            wake.notify_all();
+            for (auto& t : workers)
+                t.join();
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        size_t size() const { return workers.size(); }
+
+        // Number of NUMA nodes the threads are spread over; 1 when they are not pinned.
+        int nodes() const { return topology ? topology->nodes() : 1; }
+
+        void submit(std::function<void()> task) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                tasks.push_back(std::move(task));
+            }
+            wake.notify_one();
+        }
+
+        // Runs f on the pool. Waiting on the result from a pool thread can deadlock when
+        // every worker is waiting, so do that from outside the pool.
+        template<class F>
+        auto async(F f) -> std::future<decltype(f())> {
+            auto task = std::make_shared<std::packaged_task<decltype(f())()>>(std::move(f));
+            auto result = task->get_future();
+            submit([task] { (*task)(); });
+            return result;
+        }
+
+        // Calls body(chunk_begin, chunk_end) over [begin, end) in chunks of `grain` and
+        // returns when all of them are done.
+        void parallel_for(
+            size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& body
+        ) {
+            if (begin >= end)
+                return;
+            grain = std::max<size_t>(grain, 1);
+            auto chunks = (end - begin + grain - 1) / grain;
+
+            struct shared_state {
+                std::atomic<size_t> next{0};
+                std::atomic<size_t> done{0};
+                std::mutex mutex;
+                std::condition_variable finished;
+            };
+            auto state = std::make_shared<shared_state>();
+
+            auto work = [state, begin, end, grain, chunks, &body] {
+                size_t chunk;
+                while ((chunk = state->next.fetch_add(1)) < chunks) {
+                    auto b = begin + chunk*grain;
+                    body(b, std::min(end, b + grain));
+                    if (state->done.fetch_add(1) + 1 == chunks) {
+                        std::lock_guard<std::mutex> lock(state->mutex);
+                        state->finished.notify_all();
+                    }
+                }
+            };
+
+            // Helpers that start after every chunk is taken return without touching body.
+            auto helpers = std::min(chunks - 1, workers.size());
+            for (size_t i = 0; i < helpers; i++)
+                submit(work);
+            work();
+
+            std::unique_lock<std::mutex> lock(state->mutex);
+            state->finished.wait(lock, [&] { return state->done.load() == chunks; });
+        }
+
+        // Index of the pool thread running the caller, or -1 outside the pool.
+        static int worker_index() { return current_worker(); }
+
+        // NUMA node the caller runs on, in [0, nodes()). Pinned pool threads know theirs;
+        // other threads ask the system where they are now.
+        int worker_node() const {
+            if (!topology)
+                return 0;
+            auto node = current_node();
+            return node >= 0 && node < topology->nodes() ? node : topology->current_node();
+        }
+
+    private:
+        void run(unsigned index) {
+            current_worker() = static_cast<int>(index);
+            if (topology) {
+                auto cpu = topology->cpu_for_thread(index);
+                if (pin_current_thread(cpu))
+                    current_node() = topology->node_of(cpu);
+            }
+            while (true) {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    wake.wait(lock, [this] { return stopping || !tasks.empty(); });
+                    if (tasks.empty())
+                        return;
+                    task = std::move(tasks.front());
+                    tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+        static int& current_worker() {
+            thread_local int index = -1;
+            return index;
+        }
+
+        // Node of a pinned pool thread, -1 elsewhere. Per thread, not per pool: a pinned
+        // thread stays on its node whichever pool asks.
+        static int& current_node() {
+            thread_local int node = -1;
+            return node;
+        }
+
+    private:
+        const numa_topology* topology;   // null unless the threads are pinned
+        std::vector<std::thread> workers;
+        std::deque<std::function<void()>> tasks;
+        std::mutex mutex;
+        std::condition_variable wake;
+        bool stopping = false;
+};
+
+
+// Pool shared by everything in the process that does not bring its own. Its threads are
+// pinned when the machine has more than one NUMA node.
+inline thread_pool& default_thread_pool() {
+    static thread_pool pool(std::thread::hardware_concurrency(), &numa_topology::system());
+    return pool;
+}
+
+
+#endif
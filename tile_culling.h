@@ -0,0 +1,75 @@
+#ifndef TILE_CULLING_H
+#define TILE_CULLING_H
+
+#include "rtweekend.h"
+
+#include "camera.h"
+#include "color.h"
+#include "hittable.h"
+#include "integrator.h"
+#include "qbvh.h"
+
+#include <vector>
+
+
+// Tiles que so veem o fundo.
+//
+// Antes de renderizar um tile, testamos o feixe de raios de camera que passa pelos seus
+// pixels, contando a abertura da lente, contra as caixas dos niveis de cima da qbvh
+// (camera::misses). Se o feixe prova que nao atinge nenhuma, todo raio do tile vai
+// direto para o fundo: o tile e feito so com a cor do ambiente na direcao de cada raio,
+// com poucas amostras por pixel, sem percorrer a cena.
+//
+// Com objetos sem caixa (ou uma cena que nao e qbvh e nao tem caixa) nada e cortado.
+
+class tile_culler {
+    public:
+        // Samples per pixel of a tile that sees only the background.
+        static const int background_samples = 4;
+
+        explicit tile_culler(const hittable& world, size_t max_boxes = 64) {
+            aabb box;
+            if (auto tree = dynamic_cast<const qbvh*>(&world))
+                bounded = tree->top_boxes(boxes, max_boxes);
+            else if ((bounded = world.bounding_box(box)))
+                boxes.push_back(box);
+        }
+
+        // True when no camera ray through pixels [x0, x1) x [y0, y1) of a width x height
+        // image can reach the scene, for samples taken at (i + random_double()) / (width-1)
+        // as everywhere else.
+        bool empty(const camera& cam, int x0, int y0, int x1, int y1, int width, int height) const {
+            if (!bounded)
+                return false;
+            auto s0 = double(x0) / (width-1), s1 = double(x1) / (width-1);
+            auto t0 = double(y0) / (height-1), t1 = double(y1) / (height-1);
+            for (const auto& box : boxes)
+                if (!cam.misses(box, s0, s1, t0, t1))
+                    return false;
+            return true;
+        }
+
+    private:
+        bool bounded = false;
+        std::vector<aabb> boxes;
+};
+
+
+// Mean color of pixel (i, j) of a tile culler.empty() said sees only the background.
+color background_pixel(
+    const camera& cam, const light_set& lights, int i, int j, int width, int height,
+    int samples = tile_culler::background_samples
+) {
+    color sum(0, 0, 0);
+    for (int s = 0; s < samples; s++) {
+        auto u = (i + random_double()) / (width-1);
+        auto v = (j + random_double()) / (height-1);
+        auto path = camera_path(cam.get_ray(u, v), 1);
+        shade_miss(path, lights);
+        sum += path.radiance;
+    }
+    return sum / samples;
+}
+
+
+#endif
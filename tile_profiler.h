@@ -0,0 +1,150 @@
+#ifndef TILE_PROFILER_H
+#define TILE_PROFILER_H
+
+#include "rtweekend.h"
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <vector>
+
+
+// Tempo de renderizacao por tile.
+//
+// Cada tile registra onde fica na imagem, quantas amostras usou, quando comecou e
+// terminou e em qual thread rodou. Sao duas leituras de relogio e um push_back por
+// tile, entao da para deixar sempre ligado. Com isso saem um mapa de calor do custo por
+// pixel (um pixel por tile) e um arquivo de trace do Chrome (chrome://tracing ou
+// Perfetto) com a linha do tempo de cada thread.
+
+class tile_profiler {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        struct tile_record {
+            int column, row;           // position in the tile grid, row 0 at the top
+            int x, y, width, height;   // pixels, y counted from the top row
+            long samples;
+            double start, end;         // seconds since the profiler was created
+            int thread;                // 0 for the calling thread, 1 + worker index otherwise
+        };
+
+        tile_profiler(int image_width, int image_height, int tile)
+            : width(image_width), height(image_height), tile_size(std::max(tile, 1)),
+              origin(clock::now()) {}
+
+        double now() const {
+            return std::chrono::duration<double>(clock::now() - origin).count();
+        }
+
+        void record(
+            int column, int row, int x, int y, int w, int h, long samples, double start, double end
+        ) {
+            auto thread = thread_pool::worker_index() + 1;
+            std::lock_guard<std::mutex> lock(mutex);
+            tiles.push_back({column, row, x, y, w, h, samples, start, end, thread});
+        }
+
+        const std::vector<tile_record>& records() const { return tiles; }
+
+        // Cost per pixel of every tile, as a binary PPM with one pixel per tile, the top
+        // row first. Black is free, white is the most expensive tile.
+        bool write_heatmap(const char* filename) const;
+
+        // Tile execution per thread in the Chrome trace-event format.
+        bool write_trace(const char* filename) const;
+
+    private:
+        int width, height, tile_size;
+        clock::time_point origin;
+        std::mutex mutex;
+        std::vector<tile_record> tiles;
+};
+
+
+// Black -> red -> yellow -> white.
+inline void heat_color(double x, unsigned char rgb[3]) {
+    x = clamp(x, 0.0, 1.0);
+    rgb[0] = static_cast<unsigned char>(255 * clamp(3*x, 0.0, 1.0));
+    rgb[1] = static_cast<unsigned char>(255 * clamp(3*x - 1, 0.0, 1.0));
+    rgb[2] = static_cast<unsigned char>(255 * clamp(3*x - 2, 0.0, 1.0));
+}
+
+
+bool tile_profiler::write_heatmap(const char* filename) const {
+    auto across = (width + tile_size - 1) / tile_size;
+    auto down = (height + tile_size - 1) / tile_size;
+
+    // Tiles from a later pass over the same area add up.
+    std::vector<double> cost(static_cast<size_t>(across) * down, 0.0);
+    for (const auto& t : tiles)
+        if (t.column >= 0 && t.column < across && t.row >= 0 && t.row < down)
+            cost[static_cast<size_t>(t.row) * across + t.column] +=
+                (t.end - t.start) / std::max(t.width * t.height, 1);
+    if (cost.empty()) {
+        std::cerr << "ERROR: No tiles to write to heatmap '" << filename << "'.\n";
+        return false;
+    }
+    auto peak = *std::max_element(cost.begin(), cost.end());
+
+    auto f = fopen(filename, "wb");
+    if (!f) {
+        std::cerr << "ERROR: Could not write heatmap '" << filename << "'.\n";
+        return false;
+    }
+    fprintf(f, "P6\n%d %d\n255\n", across, down);
+    for (auto c : cost) {
+        unsigned char rgb[3];
+        heat_color(peak > 0 ? c / peak : 0, rgb);
+        fwrite(rgb, 1, 3, f);
+    }
+    return fclose(f) == 0;
+}
+
+
+bool tile_profiler::write_trace(const char* filename) const {
+    auto f = fopen(filename, "w");
+    if (!f) {
+        std::cerr << "ERROR: Could not write trace '" << filename << "'.\n";
+        return false;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+
+    // Thread names first, then one complete ("X") event per tile, in microseconds.
+    int threads = 0;
+    for (const auto& t : tiles)
+        threads = std::max(threads, t.thread + 1);
+
+    const char* separator = "\n";
+    for (int i = 0; i < threads; i++) {
+        char name[32];
+        if (i == 0)
+            snprintf(name, sizeof(name), "caller");
+        else
+            snprintf(name, sizeof(name), "worker %d", i - 1);
+        fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":%d,"
+                   "\"args\":{\"name\":\"%s\"}}", separator, i, name);
+        separator = ",\n";
+    }
+
+    for (const auto& t : tiles) {
+        fprintf(f, "%s{\"name\":\"tile %d,%d\",\"cat\":\"tile\",\"ph\":\"X\",\"pid\":0,"
+                   "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,\"args\":{\"x\":%d,\"y\":%d,"
+                   "\"width\":%d,\"height\":%d,\"samples\":%ld}}",
+                separator, t.column, t.row, t.thread, 1e6 * t.start, 1e6 * (t.end - t.start),
+                t.x, t.y, t.width, t.height, t.samples);
+        separator = ",\n";
+    }
+
+    fprintf(f, "\n]}\n");
+    return fclose(f) == 0;
+}
+
+
+#endif
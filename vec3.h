@@ -4,14 +4,17 @@
 #include <cmath>
 #include <iostream>
 
+#include <atomic>
 #include <random>
 
 using std::sqrt;
 
 // Gerar numero aleatorio de 0 a 1
 double random_double2() {
-   // Returns a random real in [0,1).
-   return rand() / (RAND_MAX + 1.0);
+   // Returns a random real in [0,1). Gerador proprio por thread, como random_double.
+   static std::atomic<unsigned> next_seed{1013904223};
+   thread_local std::mt19937 generator(next_seed++);
+   return generator() / 4294967296.0;
 }
 
 double random_double2(double min, double max) {
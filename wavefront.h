@@ -0,0 +1,93 @@
+#ifndef WAVEFRONT_H
+#define WAVEFRONT_H
+
+#include "rtweekend.h"
+
+#include "hittable.h"
+#include "integrator.h"
+#include "material.h"
+#include "material_table.h"
+#include "perf_counters.h"
+
+#include <algorithm>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+
+
+// Wavefront path tracing. Instead of following one path to the end, a whole queue of
+// paths advances one bounce at a time: every ray in the queue is intersected, the hits
+// are sorted by material class and material instance (which also groups their textures),
+// and each group is then shaded in one run so the same scatter code and texture data
+// stay hot in the caches.
+class wavefront_integrator {
+    public:
+        wavefront_integrator(
+            const hittable& w, const light_set& l, const material_table* m = nullptr
+        ) : world(w), lights(l), materials(m) {}
+
+        // Traces every path to completion and adds its radiance to film[path.pixel].
+        void trace(std::vector<path_state>& paths, std::vector<color>& film) {
+            perf_phase phase(render_phase::primary_rays);
+            for (int bounce = 0; !paths.empty(); bounce++) {
+                if (bounce == 1)
+                    phase.change(render_phase::secondary_bounces);
+                intersect(paths);
+                shade(paths, film);
+            }
+        }
+
+    private:
+        void intersect(std::vector<path_state>& paths) {
+            records.resize(paths.size());
+            found.resize(paths.size());
+            for (size_t i = 0; i < paths.size(); i++)
+                found[i] = world.hit(paths[i].r, 0.001, infinity, records[i]);
+        }
+
+        void shade(std::vector<path_state>& paths, std::vector<color>& film) {
+            // Misses finish right away; hits are keyed by their material for sorting.
+            order.clear();
+            for (size_t i = 0; i < paths.size(); i++) {
+                if (!found[i]) {
+                    shade_miss(paths[i], lights);
+                    film[paths[i].pixel] += paths[i].radiance;
+                    continue;
+                }
+                // Compiled materials sort by their table kind, the rest by class.
+                auto mat = records[i].mat_ptr.get();
+                auto entry = materials ? materials->find(mat) : nullptr;
+                auto kind = entry ? static_cast<size_t>(entry->kind) : typeid(*mat).hash_code();
+                order.push_back({{kind, mat}, static_cast<uint32_t>(i)});
+            }
+
+            std::sort(order.begin(), order.end(),
+                [](const sort_entry& a, const sort_entry& b) { return a.first < b.first; });
+
+            next.clear();
+            for (const auto& entry : order) {
+                auto& path = paths[entry.second];
+                if (shade_hit(path, records[entry.second], world, lights, materials))
+                    next.push_back(path);
+                else
+                    film[path.pixel] += path.radiance;
+            }
+
+            paths.swap(next);
+        }
+
+    private:
+        using sort_entry = std::pair<std::pair<size_t, const material*>, uint32_t>;
+
+        const hittable& world;
+        const light_set& lights;
+        const material_table* materials;
+
+        std::vector<hit_record> records;
+        std::vector<char> found;
+        std::vector<sort_entry> order;
+        std::vector<path_state> next;
+};
+
+
+#endif